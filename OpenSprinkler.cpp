@@ -26,6 +26,7 @@
 #include "gpio.h"
 #include "testmode.h"
 #include "program.h"
+#include "sim.h"
 #include "ArduinoJson.hpp"
 
 /** Declare static data members */
@@ -40,6 +41,13 @@ unsigned char OpenSprinkler::nboards;
 unsigned char OpenSprinkler::nstations;
 unsigned char OpenSprinkler::station_bits[MAX_NUM_BOARDS];
 unsigned char OpenSprinkler::engage_booster;
+#if !defined(ARDUINO)
+ulong OpenSprinkler::nshiftouts = 0;
+ulong OpenSprinkler::nshiftskips = 0;
+StationData OpenSprinkler::stations[MAX_NUM_STATIONS];
+int16_t OpenSprinkler::stations_dirty_lo = MAX_NUM_STATIONS;
+int16_t OpenSprinkler::stations_dirty_hi = -1;
+#endif
 uint16_t OpenSprinkler::baseline_current;
 
 time_os_t OpenSprinkler::sensor1_on_timer;
@@ -440,6 +448,7 @@ const char *OpenSprinkler::sopts[] = {
 	DEFAULT_DEVICE_NAME,
 	DEFAULT_EMPTY_STRING, // SOPT_STA_BSSID_CHL
 	DEFAULT_EMPTY_STRING, // SOPT_EMAIL_OPTS
+	DEFAULT_EMPTY_STRING, // SOPT_INFLUX_OPTS
 };
 
 /** Weekday strings (stored in PROGMEM to reduce RAM usage) */
@@ -453,7 +462,11 @@ static const char days_str[] PROGMEM =
 	"Sun\0";
 
 
-#if !defined(ARDUINO)
+#if defined(SIMULATION)
+static inline int32_t now() {
+	return OSSim::clock;
+}
+#elif !defined(ARDUINO)
 static inline int32_t now() {
     time_t rawtime;
     time(&rawtime);
@@ -715,6 +728,9 @@ void OpenSprinkler::reboot_dev(uint8_t cause) {
 #else // RPI/BBB/LINUX network init functions
 
 #include "etherport.h"
+#include "httpclient.h"
+#include "telemetry.h"
+#include "binlog.h"
 #include <sys/reboot.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
@@ -722,8 +738,8 @@ void OpenSprinkler::reboot_dev(uint8_t cause) {
 #include "utils.h"
 #include "opensprinkler_server.h"
 
-/** Initialize network with the given mac address and http port */
-unsigned char OpenSprinkler::start_network() {
+/** Port of the web server */
+unsigned int OpenSprinkler::http_port() {
 	unsigned int port = (unsigned int)(iopts[IOPT_HTTPPORT_1]<<8) + (unsigned int)iopts[IOPT_HTTPPORT_0];
 #if defined(DEMO)
 #if defined(HTTP_PORT)
@@ -732,7 +748,18 @@ unsigned char OpenSprinkler::start_network() {
 	port = 80;
 #endif
 #endif
-	if(otc.en>0 && otc.token.length()>=DEFAULT_OTC_TOKEN_LENGTH) {
+	return port;
+}
+
+/** Whether the web server keeps a connection to the OpenThings cloud */
+bool OpenSprinkler::otc_enabled() {
+	return otc.en>0 && otc.token.length()>=DEFAULT_OTC_TOKEN_LENGTH;
+}
+
+/** Initialize network with the given mac address and http port */
+unsigned char OpenSprinkler::start_network() {
+	unsigned int port = http_port();
+	if(otc_enabled()) {
 		otf = new OTF::OpenThingsFramework(port, otc.server.c_str(), otc.port, otc.token.c_str(), false, ether_buffer, ETHER_BUFFER_SIZE);
 		DEBUG_PRINTLN(F("Started OTF with remote connection"));
 	} else {
@@ -780,6 +807,8 @@ bool OpenSprinkler::load_hardware_mac(unsigned char* mac, bool wired) {
 void OpenSprinkler::reboot_dev(uint8_t cause) {
 	nvdata.reboot_cause = cause;
 	nvdata_save();
+	OSBinLog::sync();
+	file_close_all();
 #if defined(DEMO)
 	// do nothing
 #else
@@ -1255,6 +1284,8 @@ void OpenSprinkler::latch_apply_all_station_bits() {
 }
 #endif
 
+#define SR_REFRESH_INTERVAL 60  // seconds between shift register writes when nothing changed
+
 /** Apply all station bits
  * !!! This will activate/deactivate valves !!!
  */
@@ -1300,44 +1331,70 @@ void OpenSprinkler::apply_all_station_bits() {
 	}
 
 #else
-	digitalWrite(PIN_SR_LATCH, LOW);
-	unsigned char bid, s, sbits;
-
-	// Shift out all station bit values
-	// from the highest bit to the lowest
-	for(bid=0;bid<=MAX_EXT_BOARDS;bid++) {
-		if (status.enabled) // TODO: checking enabled bit here is inconsistent with Arduino implementation
-			sbits = station_bits[MAX_EXT_BOARDS-bid];
-		else
-			sbits = 0;
-
-		for(s=0;s<8;s++) {
-			digitalWrite(PIN_SR_CLOCK, LOW);
-	#if defined(OSPI) // if OSPI, use dynamically assigned pin_sr_data
-			digitalWrite(pin_sr_data, (sbits & ((unsigned char)1<<(7-s))) ? HIGH : LOW );
-	#else
-			digitalWrite(PIN_SR_DATA, (sbits & ((unsigned char)1<<(7-s))) ? HIGH : LOW );
+	// the shift registers hold their outputs, so they only need to be written when
+	// the bits or the enabled status change, plus a periodic refresh as a safeguard
+	static unsigned char sr_bits[MAX_NUM_BOARDS];
+	static unsigned char sr_enabled = 0;
+	static bool sr_valid = false;
+	static time_os_t sr_time = 0;
+	time_os_t sr_now = now_tz();
+	bool sr_changed = !sr_valid || sr_enabled!=status.enabled || sr_now<sr_time || (sr_now-sr_time)>=SR_REFRESH_INTERVAL ||
+	                  memcmp(sr_bits, station_bits, MAX_NUM_BOARDS);
+	#if defined(ARDUINO)
+	if((hw_type==HW_TYPE_DC) && engage_booster) sr_changed = true;
 	#endif
-			digitalWrite(PIN_SR_CLOCK, HIGH);
+
+	if(sr_changed) {
+		memcpy(sr_bits, station_bits, MAX_NUM_BOARDS);
+		sr_enabled = status.enabled;
+		sr_valid = true;
+		sr_time = sr_now;
+		#if !defined(ARDUINO)
+		nshiftouts++;
+		#endif
+
+		digitalWrite(PIN_SR_LATCH, LOW);
+		unsigned char bid, s, sbits;
+
+		// Shift out all station bit values
+		// from the highest bit to the lowest
+		for(bid=0;bid<=MAX_EXT_BOARDS;bid++) {
+			if (status.enabled) // TODO: checking enabled bit here is inconsistent with Arduino implementation
+				sbits = station_bits[MAX_EXT_BOARDS-bid];
+			else
+				sbits = 0;
+
+			for(s=0;s<8;s++) {
+				digitalWrite(PIN_SR_CLOCK, LOW);
+		#if defined(OSPI) // if OSPI, use dynamically assigned pin_sr_data
+				digitalWrite(pin_sr_data, (sbits & ((unsigned char)1<<(7-s))) ? HIGH : LOW );
+		#else
+				digitalWrite(PIN_SR_DATA, (sbits & ((unsigned char)1<<(7-s))) ? HIGH : LOW );
+		#endif
+				digitalWrite(PIN_SR_CLOCK, HIGH);
+			}
 		}
-	}
 
-	#if defined(ARDUINO)
-	if((hw_type==HW_TYPE_DC) && engage_booster) {
-		// for DC controller: boost voltage
-		digitalWrite(PIN_BOOST_EN, LOW);  // disable output path
-		digitalWrite(PIN_BOOST, HIGH);    // enable boost converter
-		delay((int)iopts[IOPT_BOOST_TIME]<<2);  // wait for booster to charge
-		digitalWrite(PIN_BOOST, LOW);  // disable boost converter
-
-		digitalWrite(PIN_BOOST_EN, HIGH);  // enable output path
-		digitalWrite(PIN_SR_LATCH, HIGH);
-		engage_booster = 0;
-	} else {
+		#if defined(ARDUINO)
+		if((hw_type==HW_TYPE_DC) && engage_booster) {
+			// for DC controller: boost voltage
+			digitalWrite(PIN_BOOST_EN, LOW);  // disable output path
+			digitalWrite(PIN_BOOST, HIGH);    // enable boost converter
+			delay((int)iopts[IOPT_BOOST_TIME]<<2);  // wait for booster to charge
+			digitalWrite(PIN_BOOST, LOW);  // disable boost converter
+
+			digitalWrite(PIN_BOOST_EN, HIGH);  // enable output path
+			digitalWrite(PIN_SR_LATCH, HIGH);
+			engage_booster = 0;
+		} else {
+			digitalWrite(PIN_SR_LATCH, HIGH);
+		}
+		#else
 		digitalWrite(PIN_SR_LATCH, HIGH);
+		#endif
 	}
-	#else
-	digitalWrite(PIN_SR_LATCH, HIGH);
+	#if !defined(ARDUINO)
+	else nshiftskips++;
 	#endif
 #endif
 
@@ -1359,9 +1416,8 @@ void OpenSprinkler::apply_all_station_bits() {
 				uint16_t dur = 0;
 				if(on) {
 					unsigned char sqi=pd.station_qid[next_sid_to_refresh];
-					RuntimeQueueStruct *q=pd.queue+sqi;
-					if(sqi<255 && q->st>0 && q->st+q->dur>curr_time) {
-						dur = q->st+q->dur-curr_time;
+					if(sqi<255 && pd.queue.st[sqi]>0 && pd.queue.end_time(sqi)>curr_time) {
+						dur = pd.queue.end_time(sqi)-curr_time;
 					}
 				}
 				switch_special_station(next_sid_to_refresh, on, dur);
@@ -1375,7 +1431,11 @@ void OpenSprinkler::detect_binarysensor_status(time_os_t curr_time) {
 	// sensor_type: 0 if normally closed, 1 if normally open
 	if(iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_RAIN || iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_SOIL) {
 		if(hw_rev>=2)	pinModeExt(PIN_SENSOR1, INPUT_PULLUP); // this seems necessary for OS 3.2
+#if defined(SIMULATION)
+		unsigned char val = OSSim::sensor_input(0);
+#else
 		unsigned char val = digitalReadExt(PIN_SENSOR1);
+#endif
 		status.sensor1 = (val == iopts[IOPT_SENSOR1_OPTION]) ? 0 : 1;
 		if(status.sensor1) {
 			if(!sensor1_on_timer) {
@@ -1405,7 +1465,11 @@ void OpenSprinkler::detect_binarysensor_status(time_os_t curr_time) {
 #if defined(ESP8266) || defined(PIN_SENSOR2)
 	if(iopts[IOPT_SENSOR2_TYPE]==SENSOR_TYPE_RAIN || iopts[IOPT_SENSOR2_TYPE]==SENSOR_TYPE_SOIL) {
 		if(hw_rev>=2)	pinModeExt(PIN_SENSOR2, INPUT_PULLUP); // this seems necessary for OS 3.2
+#if defined(SIMULATION)
+		unsigned char val = OSSim::sensor_input(1);
+#else
 		unsigned char val = digitalReadExt(PIN_SENSOR2);
+#endif
 		status.sensor2 = (val == iopts[IOPT_SENSOR2_OPTION]) ? 0 : 1;
 		if(status.sensor2) {
 			if(!sensor2_on_timer) {
@@ -1576,9 +1640,50 @@ uint16_t OpenSprinkler::parse_rfstation_code(RFStationData *data, ulong* on, ulo
 	return v;
 }
 
+/** Station table access
+ * On RPI/BBB the whole table is resident: reads are served from memory and
+ * writes are collected until stations_flush writes the changed range in one go.
+ */
+void OpenSprinkler::station_read(unsigned char sid, size_t offset, void *dst, size_t len) {
+#if defined(ARDUINO)
+	file_read_block(STATIONS_FILENAME, dst, (uint32_t)sid*sizeof(StationData)+offset, len);
+#else
+	memcpy(dst, (char*)&stations[sid]+offset, len);
+#endif
+}
+
+void OpenSprinkler::station_write(unsigned char sid, size_t offset, const void *src, size_t len) {
+#if defined(ARDUINO)
+	file_write_block(STATIONS_FILENAME, src, (uint32_t)sid*sizeof(StationData)+offset, len);
+#else
+	memcpy((char*)&stations[sid]+offset, src, len);
+	if(sid<stations_dirty_lo) stations_dirty_lo = sid;
+	if(sid>stations_dirty_hi) stations_dirty_hi = sid;
+#endif
+}
+
+void OpenSprinkler::stations_flush() {
+#if !defined(ARDUINO)
+	if(stations_dirty_hi<stations_dirty_lo) return;
+	file_write_block(STATIONS_FILENAME, &stations[stations_dirty_lo], (uint32_t)stations_dirty_lo*sizeof(StationData),
+		(uint32_t)(stations_dirty_hi-stations_dirty_lo+1)*sizeof(StationData));
+	stations_dirty_lo = MAX_NUM_STATIONS;
+	stations_dirty_hi = -1;
+#endif
+}
+
+#if !defined(ARDUINO)
+/** Load the whole station table, dropping any pending changes */
+void OpenSprinkler::stations_load() {
+	file_read_block(STATIONS_FILENAME, stations, 0, sizeof(StationData)*MAX_NUM_STATIONS);
+	stations_dirty_lo = MAX_NUM_STATIONS;
+	stations_dirty_hi = -1;
+}
+#endif
+
 /** Get station data */
 void OpenSprinkler::get_station_data(unsigned char sid, StationData* data) {
-	file_read_block(STATIONS_FILENAME, data, (uint32_t)sid*sizeof(StationData), sizeof(StationData));
+	station_read(sid, 0, data, sizeof(StationData));
 }
 
 /** Set station data */
@@ -1591,7 +1696,7 @@ void OpenSprinkler::set_station_data(unsigned char sid, StationData* data) {
 /** Get station name */
 void OpenSprinkler::get_station_name(unsigned char sid, char tmp[]) {
 	tmp[STATION_NAME_SIZE]=0;
-	file_read_block(STATIONS_FILENAME, tmp, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, name), STATION_NAME_SIZE);
+	station_read(sid, offsetof(StationData, name), tmp, STATION_NAME_SIZE);
 }
 
 /** Set station name */
@@ -1602,13 +1707,22 @@ void OpenSprinkler::set_station_name(unsigned char sid, char tmp[]) {
 	get_station_name(sid, n0);
 	size_t len = strlen(n0);
 	if(len!=strlen(tmp) || memcmp(n0, tmp, len)!=0) { // only write if the name has changed
-		file_write_block(STATIONS_FILENAME, tmp, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, name), STATION_NAME_SIZE);
+		station_write(sid, offsetof(StationData, name), tmp, STATION_NAME_SIZE);
 	}
 }
 
 /** Get station type */
 unsigned char OpenSprinkler::get_station_type(unsigned char sid) {
+#if defined(ARDUINO)
 	return file_read_byte(STATIONS_FILENAME, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, type));
+#else
+	return stations[sid].type;
+#endif
+}
+
+/** Set station type and special data */
+void OpenSprinkler::set_station_special(unsigned char sid, const char *buf) {
+	station_write(sid, offsetof(StationData, type), buf, STATION_SPECIAL_DATA_SIZE+1);
 }
 
 unsigned char OpenSprinkler::is_sequential_station(unsigned char sid) {
@@ -1667,13 +1781,16 @@ void OpenSprinkler::set_station_gid(unsigned char sid, unsigned char gid) {
 	attrib_grp[sid] = gid;
 }
 
+// attrib and type are adjacent in StationData, so both are read and written together
+#define STATION_ATTRIB_TYPE_SIZE (offsetof(StationData, type)+1-offsetof(StationData, attrib))
+
 /** Save all station attribs to file (backward compatibility) */
 void OpenSprinkler::attribs_save() {
 	// re-package attribute bits and save
 	unsigned char bid, s, sid=0;
-	StationAttrib at, at0;
+	StationAttrib at;
 	memset(&at, 0, sizeof(StationAttrib));
-	unsigned char ty = STN_TYPE_STANDARD, ty0;
+	unsigned char cur[STATION_ATTRIB_TYPE_SIZE], upd[STATION_ATTRIB_TYPE_SIZE];
 	for(bid=0;bid<MAX_NUM_BOARDS && sid<nstations;bid++) {
 		for(s=0;s<8 && sid<nstations;s++,sid++) {
 			at.mas = (attrib_mas[bid]>>s) & 1;
@@ -1685,21 +1802,21 @@ void OpenSprinkler::attribs_save() {
 			at.gid = get_station_gid(sid);
 			set_station_gid(sid, at.gid);
 
-			// only write if content has changed: this is important for LittleFS as otherwise the overhead is too large
-			file_read_block(STATIONS_FILENAME, &at0, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, attrib), sizeof(StationAttrib));
-			if(memcmp(&at,&at0,sizeof(StationAttrib))!=0) {
-				file_write_block(STATIONS_FILENAME, &at, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, attrib), sizeof(StationAttrib)); // attribte bits are 1 byte long
-			}
-			if(attrib_spe[bid]>>s==0) {
+			station_read(sid, offsetof(StationData, attrib), cur, STATION_ATTRIB_TYPE_SIZE);
+			memcpy(upd, cur, STATION_ATTRIB_TYPE_SIZE);
+			memcpy(upd, &at, sizeof(StationAttrib));
+			if(((attrib_spe[bid]>>s)&1)==0) {
 				// if station special bit is 0, make sure to write type STANDARD
-				// only write if content has changed
-				file_read_block(STATIONS_FILENAME, &ty0, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, type), 1);
-				if(ty!=ty0) {
-					file_write_block(STATIONS_FILENAME, &ty, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, type), 1); // attribte bits are 1 byte long
-				}
+				upd[STATION_ATTRIB_TYPE_SIZE-1] = STN_TYPE_STANDARD;
+			}
+			// only write if content has changed: this is important for LittleFS as otherwise the overhead is too large
+			if(memcmp(upd, cur, STATION_ATTRIB_TYPE_SIZE)!=0) {
+				station_write(sid, offsetof(StationData, attrib), upd, STATION_ATTRIB_TYPE_SIZE);
 			}
 		}
 	}
+	stations_flush();
+	ProgramData::master_dirty = true;
 }
 
 /** Load all station attribs from file (backward compatibility) */
@@ -1707,19 +1824,23 @@ void OpenSprinkler::attribs_load() {
 	// load and re-package attributes
 	unsigned char bid, s, sid=0;
 	StationAttrib at;
-	unsigned char ty;
-	memset(attrib_mas, 0, nboards);
-	memset(attrib_igs, 0, nboards);
-	memset(attrib_mas2, 0, nboards);
-	memset(attrib_igs2, 0, nboards);
-	memset(attrib_igrd, 0, nboards);
-	memset(attrib_dis, 0, nboards);
-	memset(attrib_spe, 0, nboards);
+	unsigned char buf[STATION_ATTRIB_TYPE_SIZE];
+	memset(attrib_mas, 0, MAX_NUM_BOARDS);
+	memset(attrib_igs, 0, MAX_NUM_BOARDS);
+	memset(attrib_mas2, 0, MAX_NUM_BOARDS);
+	memset(attrib_igs2, 0, MAX_NUM_BOARDS);
+	memset(attrib_igrd, 0, MAX_NUM_BOARDS);
+	memset(attrib_dis, 0, MAX_NUM_BOARDS);
+	memset(attrib_spe, 0, MAX_NUM_BOARDS);
 	memset(attrib_grp, 0, MAX_NUM_STATIONS);
+#if !defined(ARDUINO)
+	stations_load();
+#endif
 
 	for(bid=0;bid<MAX_NUM_BOARDS;bid++) {
 		for(s=0;s<8;s++,sid++) {
-			file_read_block(STATIONS_FILENAME, &at, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, attrib), sizeof(StationAttrib));
+			station_read(sid, offsetof(StationData, attrib), buf, STATION_ATTRIB_TYPE_SIZE);
+			memcpy(&at, buf, sizeof(StationAttrib));
 			attrib_mas[bid] |= (at.mas<<s);
 			attrib_igs[bid] |= (at.igs<<s);
 			attrib_mas2[bid]|= (at.mas2<<s);
@@ -1727,19 +1848,117 @@ void OpenSprinkler::attribs_load() {
 			attrib_igrd[bid]|= (at.igrd<<s);
 			attrib_dis[bid] |= (at.dis<<s);
 			attrib_grp[sid] = at.gid;
-			file_read_block(STATIONS_FILENAME, &ty, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, type), 1);
-			if(ty!=STN_TYPE_STANDARD) {
+			if(buf[STATION_ATTRIB_TYPE_SIZE-1]!=STN_TYPE_STANDARD) {
 				attrib_spe[bid] |= (1<<s);
 			}
 		}
 	}
+	ProgramData::master_dirty = true;
+}
+
+#if !defined(OS_AVR)
+// password (hash) as stored in the string options, loaded on first use
+static char password_cache[MAX_SOPTS_SIZE+1];
+static bool password_cached = false;
+#endif
+
+#if defined(USE_OTF)
+struct SessionToken {
+	char token[SESSION_TOKEN_LEN+1];  // empty: unused
+	ulong expire;  // millis()
+};
+static SessionToken sessions[SESSION_MAX];
+#endif
+
+/** The stored password has changed: reload it and end all sessions */
+static void password_changed() {
+#if !defined(OS_AVR)
+	password_cached = false;
+#endif
+#if defined(USE_OTF)
+	memset(sessions, 0, sizeof(sessions));
+#endif
+}
+
+/** Compare two strings in time that depends on n only; a and b must both hold n bytes */
+static unsigned char secure_equal(const char *a, const char *b, uint16_t n) {
+	unsigned char diff = 0;
+	for(uint16_t i=0;i<n;i++) diff |= (unsigned char)a[i] ^ (unsigned char)b[i];
+	return diff==0;
 }
 
 /** verify if a string matches password */
 unsigned char OpenSprinkler::password_verify(const char *pw) {
+#if defined(OS_AVR)
 	return (file_cmp_block(SOPTS_FILENAME, pw, SOPT_PASSWORD*MAX_SOPTS_SIZE)==0) ? 1 : 0;
+#else
+	if(!password_cached) {
+		sopt_load(SOPT_PASSWORD, password_cache);
+		// clear what an earlier, longer password left behind the string
+		uint16_t len = strlen(password_cache);
+		memset(password_cache+len, 0, sizeof(password_cache)-len);
+		password_cached = true;
+	}
+	// compare every byte of the cache, so the time taken does not tell how much matched
+	static char buf[sizeof(password_cache)];
+	uint16_t n = strlen(pw);
+	if(n>=sizeof(buf)) return 0;
+	memcpy(buf, pw, n);
+	memset(buf+n, 0, sizeof(buf)-n);
+	return secure_equal(buf, password_cache, sizeof(buf));
+#endif
+}
+
+#if defined(USE_OTF)
+static bool session_random(unsigned char *buf, uint16_t len) {
+#if defined(ESP8266)
+	for(uint16_t i=0;i<len;i++) buf[i] = (unsigned char)RANDOM_REG32;  // hardware random number generator
+	return true;
+#else
+	FILE *fp = fopen("/dev/urandom", "rb");
+	if(!fp) return false;
+	bool ok = (fread(buf, 1, len, fp)==len);
+	fclose(fp);
+	return ok;
+#endif
+}
+
+/** Issue a session token, which is accepted in place of the password for SESSION_TTL seconds
+ * When all slots are taken, the token closest to expiring is replaced.
+ */
+bool OpenSprinkler::session_start(char *token) {
+	unsigned char rnd[SESSION_TOKEN_LEN/2];
+	if(!session_random(rnd, sizeof(rnd))) return false;
+	for(unsigned char i=0;i<sizeof(rnd);i++) {
+		snprintf(token+i*2, 3, "%02x", rnd[i]);
+	}
+	ulong now = millis();
+	unsigned char slot = 0;
+	for(unsigned char i=0;i<SESSION_MAX;i++) {
+		if(!sessions[i].token[0] || (long)(sessions[i].expire-now)<=0) { slot = i; break; }
+		if((long)(sessions[i].expire-sessions[slot].expire)<0) slot = i;
+	}
+	strcpy(sessions[slot].token, token);
+	sessions[slot].expire = now + SESSION_TTL*1000UL;
+	return true;
 }
 
+bool OpenSprinkler::session_verify(const char *token) {
+	if(strlen(token)!=SESSION_TOKEN_LEN) return false;
+	ulong now = millis();
+	bool found = false;
+	for(unsigned char i=0;i<SESSION_MAX;i++) {
+		if(!sessions[i].token[0]) continue;
+		if((long)(sessions[i].expire-now)<=0) {
+			sessions[i].token[0] = 0;
+			continue;
+		}
+		if(secure_equal(sessions[i].token, token, SESSION_TOKEN_LEN)) found = true;
+	}
+	return found;
+}
+#endif
+
 // ==================
 // Schedule Functions
 // ==================
@@ -1797,62 +2016,12 @@ void OpenSprinkler::switch_special_station(unsigned char sid, unsigned char valu
 }
 
 
-/** Callback function for record_to-database (remote influxd) calls
- * Log response to console */
-void httpget_callback (char *response) {
-#if defined(SERIAL_DEBUG)
-    DEBUG_PRINTLN(response);
-#endif
-}
-
-
-void record_to_database(const char *postval) {
-    char server_with_port[32];
-	strcpy(server_with_port, "cube:8086");
-
-	int timeout_ms = 5000;
-	bool usessl = false;
-
-	char postBuffer[1500];
-	sprintf(postBuffer,
-			"POST /write?db=ospi HTTP/1.0\r\n"
-			"Accept: */*\r\n"
-			"Content-Length: %ld\r\n"
-			"Content-Type: application/json\r\n"
-			"\r\n%s",
-			strlen(postval), postval);
-
-	OpenSprinkler::send_http_request(server_with_port, postBuffer, httpget_callback, usessl, timeout_ms);
-}
-
-
-/** Record valve status
- * Send a valve's on/off status to remote influx database
- */
-void record_valve_status (unsigned char valve_num, bool status) {
-  static char postval[TMP_BUFFER_SIZE];
-  sprintf(postval, "valve%02d value=%d", valve_num, status?1:0);
-  record_to_database(postval);
-}
-
-
-/** Record current valve
- * Send the currently-on valve to emote influx database
- */
-void record_current_valve (unsigned char valve_num) {
-    static char postval[TMP_BUFFER_SIZE];
-    sprintf(postval, "valves value=%d", valve_num);
-    record_to_database(postval);
-}
-
-
 /** Set station bit
  * This function sets/resets the corresponding station bit variable
  * You have to call apply_all_station_bits next to apply the bits
  * (which results in physical actions of opening/closing valves).
  */
 unsigned char OpenSprinkler::set_station_bit(unsigned char sid, unsigned char value, uint16_t dur) {
-    record_valve_status(sid+1, !!value);
 	unsigned char *data = station_bits+(sid>>3);  // pointer to the station byte
 	unsigned char mask = (unsigned char)1<<(sid&0x07); // mask
 	if (value) {
@@ -1861,7 +2030,9 @@ unsigned char OpenSprinkler::set_station_bit(unsigned char sid, unsigned char va
 			(*data) = (*data) | mask;
 			engage_booster = true; // if bit is changing from 0 to 1, set engage_booster
 			switch_special_station(sid, 1, dur); // handle special stations
-            record_current_valve(sid+1);
+#if !defined(ARDUINO)
+			OSTelemetry::record_valve(sid, true);
+#endif
 			return 1;
 		}
 	} else {
@@ -1872,7 +2043,9 @@ unsigned char OpenSprinkler::set_station_bit(unsigned char sid, unsigned char va
 				engage_booster = true;  // if LATCH controller, engage booster when bit changes
 			}
 			switch_special_station(sid, 0); // handle special stations
-                        record_current_valve(0);
+#if !defined(ARDUINO)
+			OSTelemetry::record_valve(sid, false);
+#endif
 			return 255;
 		}
 	}
@@ -1889,7 +2062,7 @@ unsigned char OpenSprinkler::get_station_bit(unsigned char sid) {
 /** Clear all station bits */
 void OpenSprinkler::clear_all_station_bits() {
 	unsigned char sid;
-	for(sid=0;sid<=MAX_NUM_STATIONS;sid++) {
+	for(sid=0;sid<MAX_NUM_STATIONS;sid++) {
 		set_station_bit(sid, 0);
 	}
 }
@@ -1993,13 +2166,18 @@ void remote_http_callback(char* buffer) {
 
 }
 
-int8_t OpenSprinkler::send_http_request(const char* server, uint16_t port, char* p, void(*callback)(char*), bool usessl, uint16_t timeout) {
+int8_t OpenSprinkler::send_http_request(const char* server, uint16_t port, char* p, void(*callback)(char*), bool usessl, uint16_t timeout, void(*done)(int8_t)) {
 
 	if(server == NULL || server[0]==0 || port==0 ) { // sanity checking
 		DEBUG_PRINTLN("server:port is invalid!");
 		return HTTP_RQT_CONNECT_ERR;
 	}
-#if defined(ARDUINO)
+#if !defined(ARDUINO)
+	// hand the request to the asynchronous client, so that the main loop
+	// never waits on a remote host; callback is invoked from do_loop later
+	HTTPRequest rqt = {server, port, p, usessl, timeout, callback, done};
+	return OSHttpClient::submit(rqt);
+#else
 
 	Client *client = NULL;
 	#if defined(ESP8266)
@@ -2039,29 +2217,10 @@ int8_t OpenSprinkler::send_http_request(const char* server, uint16_t port, char*
 		DEBUG_PRINTLN(F("failed."));
 		client->stop();
 		delete client;
-		return HTTP_RQT_CONNECT_ERR;
-	}
-#else
-	EthernetClient *client = NULL;
-	
-	if (usessl) {
-		client = new EthernetClientSsl();
-	} else {
-		client = new EthernetClient();
-	}
-
-	DEBUG_PRINT(server);
-	DEBUG_PRINT(":");
-	DEBUG_PRINTLN(port);
-	if(!client->connect(server, port)) {
-		DEBUG_PRINT(F("failed."));
-		client->stop();
-		delete client;
+		if(done) done(HTTP_RQT_CONNECT_ERR);
 		return HTTP_RQT_CONNECT_ERR;
 	}
 
-#endif
-
 	uint16_t len = strlen(p);
 	if(len > ETHER_BUFFER_SIZE) len = ETHER_BUFFER_SIZE;
 	if(client->connected()) {
@@ -2073,7 +2232,6 @@ int8_t OpenSprinkler::send_http_request(const char* server, uint16_t port, char*
 	uint32_t stoptime = millis()+timeout;
 
 	int pos = 0;
-#if defined(ARDUINO)
 	// with ESP8266 core 3.0.2, client->connected() is not always true even if there is more data
 	// so this loop is going to take longer than it should be
 	// todo: can consider using HTTPClient for ESP8266
@@ -2094,20 +2252,20 @@ int8_t OpenSprinkler::send_http_request(const char* server, uint16_t port, char*
 			break;
 		}
 	}
-#else
-	len = client->read((uint8_t *)ether_buffer+pos, ETHER_BUFFER_SIZE);
-	pos += len;
-
-#endif
 	ether_buffer[pos]=0; // properly end buffer with 0
 	client->stop();
 	delete client;
-	if(strlen(ether_buffer)==0) return HTTP_RQT_EMPTY_RETURN;
+	if(strlen(ether_buffer)==0) {
+		if(done) done(HTTP_RQT_EMPTY_RETURN);
+		return HTTP_RQT_EMPTY_RETURN;
+	}
 	if(callback) callback(ether_buffer);
+	if(done) done(HTTP_RQT_SUCCESS);
 	return HTTP_RQT_SUCCESS;
+#endif
 }
 
-int8_t OpenSprinkler::send_http_request(uint32_t ip4, uint16_t port, char* p, void(*callback)(char*), bool usessl, uint16_t timeout) {
+int8_t OpenSprinkler::send_http_request(uint32_t ip4, uint16_t port, char* p, void(*callback)(char*), bool usessl, uint16_t timeout, void(*done)(int8_t)) {
 	char server[20];
 	unsigned char ip[4];
 	ip[0] = ip4>>24;
@@ -2115,13 +2273,13 @@ int8_t OpenSprinkler::send_http_request(uint32_t ip4, uint16_t port, char* p, vo
 	ip[2] = (ip4>>8)&0xff;
 	ip[3] = ip4&0xff;
 	snprintf(server, 20, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
-	return send_http_request(server, port, p, callback, usessl, timeout);
+	return send_http_request(server, port, p, callback, usessl, timeout, done);
 }
 
-int8_t OpenSprinkler::send_http_request(char* server_with_port, char* p, void(*callback)(char*), bool usessl, uint16_t timeout) {
+int8_t OpenSprinkler::send_http_request(char* server_with_port, char* p, void(*callback)(char*), bool usessl, uint16_t timeout, void(*done)(int8_t)) {
 	char * server = strtok(server_with_port, ":");
 	char * port = strtok(NULL, ":");
-	return send_http_request(server, (port==NULL)?80:atoi(port), p, callback, usessl, timeout);
+	return send_http_request(server, (port==NULL)?80:atoi(port), p, callback, usessl, timeout, done);
 }
 
 /** Switch remote IP station
@@ -2301,6 +2459,9 @@ void OpenSprinkler::factory_reset() {
 
 	// 5. write 'done' file
 	file_write_byte(DONE_FILENAME, 0, 1);
+#if !defined(ARDUINO)
+	file_flush_all();
+#endif
 }
 
 /** Parse OTC configuration */
@@ -2531,6 +2692,7 @@ void OpenSprinkler::populate_master() {
 	masters[MASTER_2][MASOPT_SID] = iopts[IOPT_MASTER_STATION_2];
 	masters[MASTER_2][MASOPT_ON_ADJ] = iopts[IOPT_MASTER_ON_ADJ_2];
 	masters[MASTER_2][MASOPT_OFF_ADJ] = iopts[IOPT_MASTER_OFF_ADJ_2];
+	ProgramData::master_dirty = true;
 }
 
 /** Save integer options to file */
@@ -2539,6 +2701,7 @@ void OpenSprinkler::iopts_save() {
 	nboards = iopts[IOPT_EXT_BOARDS]+1;
 	nstations = nboards * 8;
 	status.enabled = iopts[IOPT_DEVICE_ENABLE];
+	ProgramData::master_dirty = true;
 }
 
 /** Load a string option from file */
@@ -2557,6 +2720,7 @@ String OpenSprinkler::sopt_load(unsigned char oid) {
 
 /** Save a string option to file */
 bool OpenSprinkler::sopt_save(unsigned char oid, const char *buf) {
+	if(oid==SOPT_PASSWORD) password_changed();
 	// smart save: if value hasn't changed, don't write
 	if(file_cmp_block(SOPTS_FILENAME, buf, (ulong)MAX_SOPTS_SIZE*oid)==0) return false;
 	int len = strlen(buf);
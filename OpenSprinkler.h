@@ -272,6 +272,10 @@ public:
 	static void reboot_dev(uint8_t);  // reboot the microcontroller
 	static void begin();  // initialization, must call this function before calling other functions
 	static unsigned char start_network();  // initialize network with the given mac and port
+#if !defined(ARDUINO)
+	static unsigned int http_port();  // port of the web server
+	static bool otc_enabled();  // whether the web server connects to the OpenThings cloud
+#endif
 	static unsigned char start_ether();  // initialize ethernet with the given mac and port
 	static bool network_connected();  // check if the network is up
 	static bool load_hardware_mac(unsigned char* buffer, bool wired=false);  // read hardware mac address
@@ -282,6 +286,8 @@ public:
 	static void get_station_name(unsigned char sid, char buf[]); // get station name
 	static void set_station_name(unsigned char sid, char buf[]); // set station name
 	static unsigned char get_station_type(unsigned char sid); // get station type
+	static void set_station_special(unsigned char sid, const char *buf); // set station type (buf[0]) and special data
+	static void stations_flush(); // write out pending station changes
 	static unsigned char is_sequential_station(unsigned char sid);
 	static unsigned char is_master_station(unsigned char sid);
 	static unsigned char bound_to_master(unsigned char sid, unsigned char mas);
@@ -316,6 +322,10 @@ public:
 	static String sopt_load(unsigned char oid);
 	static void populate_master();
 	static unsigned char password_verify(const char *pw);  // verify password
+#if defined(USE_OTF)
+	static bool session_start(char *token);  // issue a session token (SESSION_TOKEN_LEN hex digits)
+	static bool session_verify(const char *token);  // verify an unexpired session token
+#endif
 
 	// -- controller operation
 	static void enable();   // enable controller operation
@@ -337,10 +347,15 @@ public:
 	static void switch_special_station(unsigned char sid, unsigned char value, uint16_t dur=0); // swtich special station
 	static void clear_all_station_bits(); // clear all station bits
 	static void apply_all_station_bits(); // apply all station bits (activate/deactive values)
+	#if !defined(ARDUINO)
+	static ulong nshiftouts;   // shift register updates written out
+	static ulong nshiftskips;  // shift register updates skipped as the outputs already matched
+	#endif
 
-	static int8_t send_http_request(uint32_t ip4, uint16_t port, char* p, void(*callback)(char*)=NULL, bool usessl=false, uint16_t timeout=5000);
-	static int8_t send_http_request(const char* server, uint16_t port, char* p, void(*callback)(char*)=NULL, bool usessl=false, uint16_t timeout=5000);
-	static int8_t send_http_request(char* server_with_port, char* p, void(*callback)(char*)=NULL, bool usessl=false, uint16_t timeout=5000);
+	// done, if given, is called with the HTTP_RQT_* result once a request that was accepted has finished
+	static int8_t send_http_request(uint32_t ip4, uint16_t port, char* p, void(*callback)(char*)=NULL, bool usessl=false, uint16_t timeout=5000, void(*done)(int8_t)=NULL);
+	static int8_t send_http_request(const char* server, uint16_t port, char* p, void(*callback)(char*)=NULL, bool usessl=false, uint16_t timeout=5000, void(*done)(int8_t)=NULL);
+	static int8_t send_http_request(char* server_with_port, char* p, void(*callback)(char*)=NULL, bool usessl=false, uint16_t timeout=5000, void(*done)(int8_t)=NULL);
 	
 	#if defined(USE_OTF)
 	static OTCConfig otc;
@@ -425,6 +440,14 @@ private:
 #endif // LCD functions
 	static unsigned char engage_booster;
 
+	static void station_read(unsigned char sid, size_t offset, void *dst, size_t len);
+	static void station_write(unsigned char sid, size_t offset, const void *src, size_t len);
+	#if !defined(ARDUINO)
+	static StationData stations[]; // resident copy of stns.dat
+	static int16_t stations_dirty_lo, stations_dirty_hi; // range of stations not yet written out
+	static void stations_load();
+	#endif
+
 	#if defined(USE_OTF)
 	static void parse_otc_config();
 	#endif
@@ -0,0 +1,563 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Microbenchmarks
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#if defined(BENCHMARK)
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include "OpenSprinkler.h"
+#include "program.h"
+#include "opensprinkler_server.h"
+#include "binlog.h"
+#include "main.h"
+#include "gpio.h"
+#include "bench.h"
+
+extern OpenSprinkler os;
+extern ProgramData pd;
+unsigned char findKeyVal(const char *str, char *strbuf, uint16_t maxlen, const char *key, bool key_in_pgm=false, uint8_t *keyfound=NULL);
+void kv_table_parse(const char *str);
+void kv_table_clear();
+
+char OSBench::data_dir[] = "/tmp/os-bench-XXXXXX";
+
+// results are accumulated here so that the measured calls cannot be optimized away
+static volatile ulong bench_sink;
+// bytes produced by the current round, for cases that report a throughput
+static ulong bench_bytes;
+
+#if (defined(OSPI) || defined(OSBO)) && !defined(GPIOMEM) && !defined(LIBGPIOD)
+#define BENCH_SYSFS  // GPIO goes through sysfs value files (make bench-sysfs)
+#endif
+
+// 2024-01-01 (a Monday) in days since epoch; the synthetic log set starts here
+#define BENCH_BASE_DAY  19723UL
+
+/** ProgramStruct::check_match over every minute of a week */
+static void bm_check_match(ulong iters) {
+	ProgramStruct prog;
+	memset((void*)&prog, 0, sizeof(prog));
+	prog.enabled = 1;
+	prog.type = PROGRAM_TYPE_WEEKLY;
+	prog.starttime_type = 1;
+	prog.days[0] = 0x15;  // Mon, Wed, Fri
+	prog.starttimes[0] = 6*60;
+	prog.starttimes[1] = 12*60;
+	prog.starttimes[2] = 18*60;
+	prog.starttimes[3] = 21*60+30;
+	time_os_t t0 = BENCH_BASE_DAY*86400L;
+	ulong n = 0;
+	for(ulong i=0; i<iters; i++) {
+		n += prog.check_match(t0 + (i % (7*1440)) * 60);
+	}
+	bench_sink += n;
+}
+
+/** findKeyVal on a typical /cs query, looking up the last key */
+static void bm_find_key_val(ulong iters) {
+	static const char query[] = "pw=a6d82bced638de3def1e9bbb4983225c&s0=Front%20Lawn&s1=Back%20Lawn&s2=Drip&s3=Beds&m0=255&d0=0&q0=0&n0=0&ignore_rain=1";
+	char buf[TMP_BUFFER_SIZE];
+	ulong n = 0;
+	for(ulong i=0; i<iters; i++) {
+		n += findKeyVal(query, buf, TMP_BUFFER_SIZE, PSTR("ignore_rain"), true);
+	}
+	bench_sink += n;
+}
+
+/** A weather service reply, as passed to getweather_callback */
+static const char bench_weather_reply[] = "&scale=82&tz=48&sunrise=392&sunset=1193&eip=1249796710&rd=0&errCode=0"
+	"&rawData={\"h\":54.2,\"p\":0.08,\"t\":71.6,\"raining\":0,\"wp\":\"Zimmerman\"}&scales=[82,87,93,99,104,110,115]";
+
+/** The lookups of getweather_callback, scanning the reply each time */
+static void bm_find_key_val_weather_scan(ulong iters) {
+	static const char *const keys[] = {"errCode", "scale", "sunrise", "sunset", "eip", "tz", "rd", "rawData"};
+	char buf[TMP_BUFFER_SIZE];
+	ulong n = 0;
+	kv_table_clear();
+	for(ulong i=0; i<iters; i++) {
+		for(unsigned char k=0; k<sizeof(keys)/sizeof(keys[0]); k++) {
+			n += findKeyVal(bench_weather_reply, buf, TMP_BUFFER_SIZE, keys[k]);
+		}
+	}
+	bench_sink += n;
+}
+
+/** Same lookups with the reply parsed once */
+static void bm_find_key_val_weather_table(ulong iters) {
+	static const char *const keys[] = {"errCode", "scale", "sunrise", "sunset", "eip", "tz", "rd", "rawData"};
+	char buf[TMP_BUFFER_SIZE];
+	ulong n = 0;
+	for(ulong i=0; i<iters; i++) {
+		kv_table_parse(bench_weather_reply);
+		for(unsigned char k=0; k<sizeof(keys)/sizeof(keys[0]); k++) {
+			n += findKeyVal(bench_weather_reply, buf, TMP_BUFFER_SIZE, keys[k]);
+		}
+		kv_table_clear();
+	}
+	bench_sink += n;
+}
+
+/** urlDecode of a station name; includes copying the encoded text in */
+static void bm_url_decode(ulong iters) {
+	static const char encoded[] = "Front%20Lawn%20%28North%29%20-%20Rotor%20%2B%20Spray%20Zone%20%231";
+	char buf[sizeof(encoded)];
+	ulong n = 0;
+	for(ulong i=0; i<iters; i++) {
+		memcpy(buf, encoded, sizeof(encoded));
+		urlDecode(buf);
+		n += buf[0];
+	}
+	bench_sink += n;
+}
+
+/** BufferFiller::emit_p with the mix of fields /jc and /js produce */
+static void bm_emit_p(ulong iters) {
+	char buf[TMP_BUFFER_SIZE];
+	ulong n = 0;
+	for(ulong i=0; i<iters; i++) {
+		BufferFiller bf(buf, sizeof(buf));
+		bf.emit_p(PSTR("{\"devt\":$L,\"nbrd\":$D,\"en\":$D,\"sn\":\"$S\",\"mac\":\"$X:$X\",\"wl\":$D}"),
+		          (uint32_t)(1704067200UL+i), os.nboards, 1, "Front Lawn", 0xA4, 0x3C, -5);
+		n += bf.position();
+	}
+	bench_sink += n;
+}
+
+/** BufferFiller::emit_p as it was before the integer writers: $D and $L go through snprintf */
+class SnprintfFiller {
+	char *start;
+	char *ptr;
+	size_t len;
+public:
+	SnprintfFiller (char *buf, size_t buffer_len) {
+		start = buf;
+		ptr = buf;
+		len = buffer_len;
+	}
+
+	unsigned int position () const { return ptr - start; }
+
+	void emit_p(PGM_P fmt, ...) {
+		va_list ap;
+		va_start(ap, fmt);
+		for (;;) {
+			char c = pgm_read_byte(fmt++);
+			if (c == 0)
+				break;
+			if (c != '$') {
+				*ptr++ = c;
+				continue;
+			}
+			c = pgm_read_byte(fmt++);
+			switch (c) {
+			case 'D':
+				snprintf((char*) ptr, len - position(),  "%d", va_arg(ap, int));
+				break;
+			case 'L':
+				snprintf((char*) ptr, len - position(), "%lu", (unsigned long) va_arg(ap, uint32_t));
+				break;
+			case 'S':
+				strcpy((char*) ptr, va_arg(ap, const char*));
+				break;
+			case 'X': {
+				char d = va_arg(ap, int);
+				*ptr++ = dec2hexchar((d >> 4) & 0x0F);
+				*ptr++ = dec2hexchar(d & 0x0F);
+			}
+				continue;
+			default:
+				*ptr++ = c;
+				continue;
+			}
+			ptr += strlen((char*) ptr);
+		}
+		*(ptr)=0;
+		va_end(ap);
+	}
+};
+
+/** BM_emit_p with the typed writers only: the most a compile-time parsed format could save */
+static void bm_emit_p_typed(ulong iters) {
+	char buf[TMP_BUFFER_SIZE];
+	ulong n = 0;
+	for(ulong i=0; i<iters; i++) {
+		BufferFiller bf(buf, sizeof(buf));
+		bf.emit_p(PSTR("{\"devt\":"));
+		bf.emit_uint(1704067200UL+i);
+		bf.emit_p(PSTR(",\"nbrd\":"));
+		bf.emit_int(os.nboards);
+		bf.emit_p(PSTR(",\"en\":"));
+		bf.emit_int(1);
+		bf.emit_p(PSTR(",\"sn\":\"Front Lawn\",\"mac\":\"A4:3C\",\"wl\":"));
+		bf.emit_int(-5);
+		bf.emit_char('}');
+		n += bf.position();
+	}
+	bench_sink += n;
+}
+
+/** BM_emit_p on the snprintf filler */
+static void bm_emit_p_snprintf(ulong iters) {
+	char buf[TMP_BUFFER_SIZE];
+	ulong n = 0;
+	for(ulong i=0; i<iters; i++) {
+		SnprintfFiller bf(buf, sizeof(buf));
+		bf.emit_p(PSTR("{\"devt\":$L,\"nbrd\":$D,\"en\":$D,\"sn\":\"$S\",\"mac\":\"$X:$X\",\"wl\":$D}"),
+		          (uint32_t)(1704067200UL+i), os.nboards, 1, "Front Lawn", 0xA4, 0x3C, -5);
+		n += bf.position();
+	}
+	bench_sink += n;
+}
+
+#define BENCH_JA_PROGRAMS  10  // programs in the /ja body
+
+// the per-element writes of the /ja loops, as the handlers do them now...
+static void ja_uint(BufferFiller &out, uint32_t v) { out.emit_uint(v); }
+static void ja_char(BufferFiller &out, char c) { out.emit_char(c); }
+static void ja_bit(BufferFiller &out, unsigned char b) { out.emit_char('0'+b); }
+static void ja_name(BufferFiller &out, const char *s) { out.emit_json_str(s, STATION_NAME_SIZE); }
+// ...and as they were done with the snprintf emit_p
+static void ja_uint(SnprintfFiller &out, uint32_t v) { out.emit_p(PSTR("$L"), v); }
+static void ja_char(SnprintfFiller &out, char c) { char fmt[2] = {c, 0}; out.emit_p(fmt); }
+static void ja_bit(SnprintfFiller &out, unsigned char b) { out.emit_p(PSTR("$D"), b); }
+static void ja_name(SnprintfFiller &out, const char *s) { out.emit_p(PSTR("\"$S\""), s); }
+
+/** The station count dependent part of the /ja body: programs, status and stations
+ * The handlers take an OTF request, so this repeats their output loops
+ * on a filler of either kind; the fixed-size settings and options are left out.
+ */
+template<class F> static void bench_ja_body(F &out) {
+	static char name[STATION_NAME_SIZE+1];
+	unsigned char i, sid;
+	out.emit_p(PSTR("{\"programs\":{\"nprogs\":$D,\"nboards\":$D,\"mnp\":$D,\"mnst\":$D,\"pnsize\":$D,\"pd\":["),
+	           BENCH_JA_PROGRAMS, os.nboards, MAX_NUM_PROGRAMS, MAX_NUM_STARTTIMES, PROGRAM_NAME_SIZE);
+	for(unsigned char pid=0; pid<BENCH_JA_PROGRAMS; pid++) {
+		out.emit_p(PSTR("[$D,$D,$D,["), 0x41, 127, 0);
+		for(i=0; i<MAX_NUM_STARTTIMES-1; i++) out.emit_p(PSTR("$D,"), 360+i*60);
+		out.emit_p(PSTR("$D],["), 360+i*60);
+		for(sid=0; sid<os.nstations-1; sid++) {
+			ja_uint(out, (sid%3) ? 0 : 600+sid);
+			ja_char(out, ',');
+		}
+		out.emit_p(PSTR("$L],\""), (unsigned long)600);
+		out.emit_p(PSTR("$S\",[$D,$D,$D]]"), "Program", 0, 0, 0);
+		if(pid!=BENCH_JA_PROGRAMS-1) out.emit_p(PSTR(","));
+	}
+	out.emit_p(PSTR("]},\"status\":{\"sn\":["));
+	for(sid=0; sid<os.nstations; sid++) {
+		ja_bit(out, (os.station_bits[(sid>>3)]>>(sid&0x07))&1);
+		if(sid!=os.nstations-1) ja_char(out, ',');
+	}
+	out.emit_p(PSTR("],\"nstations\":$D},\"stations\":{"), os.nstations);
+	for(unsigned char a=0; a<8; a++) {
+		out.emit_p(PSTR("\"attr$D\":["), a);
+		for(i=0; i<os.nboards; i++) {
+			out.emit_p(PSTR("$D"), os.attrib_dis[i]);
+			if(i!=os.nboards-1) out.emit_p(PSTR(","));
+		}
+		out.emit_p(PSTR("],"));
+	}
+	out.emit_p(PSTR("\"snames\":["));
+	for(sid=0; sid<os.nstations; sid++) {
+		os.get_station_name(sid, name);
+		ja_name(out, name);
+		if(sid!=os.nstations-1) ja_char(out, ',');
+	}
+	out.emit_p(PSTR("],\"maxlen\":$D}}"), STATION_NAME_SIZE);
+}
+
+static char ja_buf[65536];
+
+/** The /ja body on the response filler, and on the snprintf one */
+static void bm_json_all(ulong iters) {
+	for(ulong i=0; i<iters; i++) {
+		BufferFiller bf(ja_buf, sizeof(ja_buf));
+		bench_ja_body(bf);
+		bench_bytes += bf.position();
+	}
+}
+
+static void bm_json_all_snprintf(ulong iters) {
+	for(ulong i=0; i<iters; i++) {
+		SnprintfFiller bf(ja_buf, sizeof(ja_buf));
+		bench_ja_body(bf);
+		bench_bytes += bf.position();
+	}
+}
+
+/** write_log of station records, 48 a day, after the synthetic log set
+ * Waits for the writer after every batch, so this is the cost of a record
+ * including its share of the file write, not just of queueing it.
+ */
+static void bm_write_log(ulong iters) {
+	static time_os_t t = (BENCH_BASE_DAY+BENCH_LOG_DAYS+1)*86400L;
+	for(ulong i=0; i<iters; i++) {
+		pd.lastrun.station = i % os.nstations;
+		pd.lastrun.program = 1;
+		pd.lastrun.duration = 600;
+		pd.lastrun.endtime = t;
+		write_log(LOGDATA_STATION, t);
+		t += 86400 / BENCH_LOG_PER_DAY;
+		if(i % BINLOG_FLUSH_RECORDS == BINLOG_FLUSH_RECORDS-1) OSBinLog::sync();
+	}
+	OSBinLog::close();
+}
+
+static char jl_buf[ETHER_BUFFER_SIZE*2];
+static BufferFiller jl_bfill;
+static ulong jl_bytes;
+
+static void jl_flush() {
+	jl_bytes += jl_bfill.position();
+	jl_bfill = BufferFiller(jl_buf, sizeof(jl_buf), jl_flush);
+}
+
+/** The /jl response body for 365 days of binary logs, unfiltered type
+ * server_json_log itself takes an OTF request, so this runs its per-day
+ * output loop (json_log_days) with a filler that discards full buffers.
+ */
+static void bm_json_log(ulong iters) {
+	for(ulong i=0; i<iters; i++) {
+		jl_bytes = 0;
+		jl_bfill = BufferFiller(jl_buf, sizeof(jl_buf), jl_flush);
+		jl_bfill.emit_p(PSTR("["));
+		json_log_days(jl_bfill, BENCH_BASE_DAY, BENCH_BASE_DAY+BENCH_LOG_DAYS-1, "", false);
+		jl_bfill.emit_p(PSTR("]"));
+		bench_sink += jl_bytes + jl_bfill.position();
+	}
+}
+
+/** The storage part of do_setup: options, station table and attribs, program counts
+ * (the network, MQTT and web server start-up are left out)
+ */
+static void bm_do_setup_storage(ulong iters) {
+	for(ulong i=0; i<iters; i++) {
+		os.options_setup();
+		pd.init();
+	}
+	bench_sink += os.nstations;
+}
+
+/** apply_all_station_bits when a valve changes every call (shift-out each time) */
+static void bm_apply_bits_changed(ulong iters) {
+	for(ulong i=0; i<iters; i++) {
+		os.station_bits[i % os.nboards] ^= 1;
+		os.apply_all_station_bits();
+	}
+	os.clear_all_station_bits();
+	bench_sink += os.nshiftouts;
+}
+
+/** apply_all_station_bits with nothing changed, as in most control cycles */
+static void bm_apply_bits_unchanged(ulong iters) {
+	for(ulong i=0; i<iters; i++) {
+		os.apply_all_station_bits();
+	}
+	bench_sink += os.nshiftskips;
+}
+
+static void fill_queue() {
+	pd.reset_runtime();
+	os.status.program_busy = 0;
+	for(unsigned char sid=0; sid<os.nstations; sid++) {
+		pd.enqueue(600, sid, 1);
+	}
+}
+
+/** Baseline for the next one: reset and fill the queue only */
+static void bm_fill_queue(ulong iters) {
+	for(ulong i=0; i<iters; i++) {
+		fill_queue();
+	}
+	bench_sink += pd.nqueue;
+}
+
+/** schedule_all_stations with a full queue, one element per station */
+static void bm_schedule_all_stations(ulong iters) {
+	time_os_t t = BENCH_BASE_DAY*86400L + 6*3600;
+	for(ulong i=0; i<iters; i++) {
+		fill_queue();
+		schedule_all_stations(t);
+	}
+	bench_sink += pd.queue.st[0];
+	pd.reset_runtime();
+	os.status.program_busy = 0;
+}
+
+static const BenchCase bench_cases[] = {
+	{"BM_check_match", bm_check_match},
+	{"BM_findKeyVal", bm_find_key_val},
+	{"BM_findKeyVal/weather_reply/scan", bm_find_key_val_weather_scan},
+	{"BM_findKeyVal/weather_reply/table", bm_find_key_val_weather_table},
+	{"BM_urlDecode", bm_url_decode},
+	{"BM_emit_p", bm_emit_p},
+	{"BM_emit_p/typed", bm_emit_p_typed},
+	{"BM_emit_p/snprintf", bm_emit_p_snprintf},
+	{"BM_server_json_all/body", bm_json_all},
+	{"BM_server_json_all/body/snprintf", bm_json_all_snprintf},
+	{"BM_write_log", bm_write_log},
+	{"BM_server_json_log/365d", bm_json_log},
+	{"BM_do_setup/storage", bm_do_setup_storage},
+	{"BM_apply_all_station_bits/changed", bm_apply_bits_changed},
+	{"BM_apply_all_station_bits/unchanged", bm_apply_bits_unchanged},
+	{"BM_fill_queue/full", bm_fill_queue},
+	{"BM_schedule_all_stations/full", bm_schedule_all_stations},
+};
+
+static double bench_ns(clockid_t id) {
+	struct timespec ts;
+	clock_gettime(id, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#if defined(BENCH_SYSFS)
+static char bench_sysfs[64];
+
+static void bench_touch(const char *dir, const char *name, const char *content) {
+	char path[sizeof(bench_sysfs)+32];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	FILE *fp = fopen(path, "w");
+	if(!fp) return;
+	fputs(content, fp);
+	fclose(fp);
+}
+
+/** A copy of the /sys/class/gpio layout with every pin already exported
+ * The files are plain files, so the figures include the system calls of
+ * each access but not the kernel GPIO driver behind real value files.
+ * It also keeps the bench from switching real valves on a Pi.
+ */
+static void bench_sysfs_tree(const char *dir) {
+	snprintf(bench_sysfs, sizeof(bench_sysfs), "%s/gpio", dir);
+	mkdir(bench_sysfs, 0755);
+	bench_touch(bench_sysfs, "export", "");
+	bench_touch(bench_sysfs, "unexport", "");
+	char pin_dir[sizeof(bench_sysfs)+16];
+	for(int pin=0; pin<64; pin++) {
+		snprintf(pin_dir, sizeof(pin_dir), "%s/gpio%d", bench_sysfs, pin);
+		mkdir(pin_dir, 0755);
+		bench_touch(pin_dir, "direction", "in");
+		bench_touch(pin_dir, "value", "0");
+		bench_touch(pin_dir, "edge", "none");
+	}
+	gpio_sysfs_dir(bench_sysfs);
+}
+#endif
+
+/** Scratch controller: all expansion boards, logging on, synthetic log set */
+void OSBench::setup() {
+	if(!mkdtemp(data_dir)) {
+		perror("bench: mkdtemp");
+		exit(1);
+	}
+	set_data_dir(data_dir);
+#if defined(BENCH_SYSFS)
+	bench_sysfs_tree(data_dir);
+#endif
+	os.begin();
+	os.options_setup();
+	pd.init();
+	os.iopts[IOPT_EXT_BOARDS] = MAX_EXT_BOARDS;
+	os.iopts[IOPT_ENABLE_LOGGING] = 1;
+	os.iopts_save();
+	os.status.enabled = 1;
+
+	BinLogRecord rec;
+	memset(&rec, 0, sizeof(rec));
+	for(ulong day=BENCH_BASE_DAY; day<BENCH_BASE_DAY+BENCH_LOG_DAYS; day++) {
+		for(unsigned char i=0; i<BENCH_LOG_PER_DAY; i++) {
+			rec.time = day*86400 + 6*3600 + i*300;
+			// one water level record a day, the rest are station runs
+			rec.type = i ? LOGDATA_STATION : LOGDATA_WATERLEVEL;
+			rec.pid = 1;
+			rec.sid = i % os.nstations;
+			rec.value = i ? 300 : 100;
+			OSBinLog::append(rec);
+		}
+		OSBinLog::sync();
+	}
+	OSBinLog::close();
+}
+
+static int bench_rm(const char *path, const struct stat *, int, struct FTW *) {
+	return remove(path);
+}
+
+void OSBench::cleanup() {
+	nftw(data_dir, bench_rm, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/** Run a case with growing iteration counts until it takes BENCH_MIN_TIME_MS */
+void OSBench::measure(const BenchCase &bc, bool comma) {
+	ulong iters = 1;
+	double real, cpu;
+	for(;;) {
+		bench_bytes = 0;
+		double r0 = bench_ns(CLOCK_MONOTONIC), c0 = bench_ns(CLOCK_PROCESS_CPUTIME_ID);
+		bc.fn(iters);
+		real = bench_ns(CLOCK_MONOTONIC) - r0;
+		cpu = bench_ns(CLOCK_PROCESS_CPUTIME_ID) - c0;
+		if(real >= BENCH_MIN_TIME_MS*1e6 || iters >= 1000000000UL) break;
+		// aim a bit past the minimum time, growing at most tenfold per round
+		double mult = (real > 0) ? BENCH_MIN_TIME_MS*1e6*1.4/real : 10;
+		if(mult > 10) mult = 10;
+		ulong next = (ulong)(iters*mult);
+		iters = (next > iters) ? next : iters+1;
+	}
+	printf("%s\n    {\n", comma ? "," : "");
+	printf("      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n      \"run_type\": \"iteration\",\n", bc.name, bc.name);
+	printf("      \"iterations\": %lu,\n", iters);
+	if(bench_bytes) printf("      \"bytes_per_second\": %.0f,\n", bench_bytes/(cpu/1e9));
+	printf("      \"real_time\": %.3f,\n      \"cpu_time\": %.3f,\n      \"time_unit\": \"ns\"\n    }", real/iters, cpu/iters);
+}
+
+int OSBench::run(const char *filter) {
+	setup();
+
+	char date[32], host[64] = {0};
+	time_t t = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&t));
+	gethostname(host, sizeof(host)-1);
+	printf("{\n  \"context\": {\n");
+	printf("    \"date\": \"%s\",\n    \"host_name\": \"%s\",\n", date, host);
+	printf("    \"executable\": \"OpenSprinkler-bench\",\n    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+	printf("    \"firmware_version\": \"%d.%d\",\n    \"nstations\": %d\n  },\n", OS_FW_VERSION, OS_FW_MINOR, os.nstations);
+	printf("  \"benchmarks\": [");
+	bool comma = false;
+	for(unsigned char i=0; i<sizeof(bench_cases)/sizeof(bench_cases[0]); i++) {
+		if(filter && !strstr(bench_cases[i].name, filter)) continue;
+		measure(bench_cases[i], comma);
+		comma = true;
+		fflush(stdout);
+	}
+	printf("\n  ]\n}\n");
+
+	cleanup();
+	return 0;
+}
+
+#endif
@@ -0,0 +1,62 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Microbenchmarks header file
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#if defined(BENCHMARK)
+
+#include "types.h"
+
+#define BENCH_MIN_TIME_MS  500  // each benchmark runs at least this long
+#define BENCH_LOG_DAYS     365  // size of the synthetic log set
+#define BENCH_LOG_PER_DAY  48   // records per day in the synthetic log set
+
+/** One benchmark: fn runs the measured operation iters times */
+struct BenchCase {
+	const char *name;
+	void (*fn)(ulong iters);
+};
+
+/** Firmware microbenchmarks (build with -DDEMO -DBENCHMARK, see make bench)
+ * The hot paths are run against a scratch data directory with the demo
+ * (no-op) GPIO backend, or with the OSPi sysfs backend (make bench-sysfs). Results are printed to stdout in the JSON format
+ * of Google Benchmark, so that its compare.py can diff two commits:
+ *
+ *   OpenSprinkler-bench [filter] > before.json
+ *
+ * Only benchmarks whose name contains filter are run. Cases that produce a
+ * response body also report its bytes_per_second.
+ */
+class OSBench {
+public:
+	static int run(const char *filter);
+private:
+	static char data_dir[];
+	static void setup();
+	static void cleanup();
+	static void measure(const BenchCase &bc, bool comma);
+};
+
+#endif
+
+#endif // _BENCH_H
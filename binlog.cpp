@@ -0,0 +1,648 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Binary log store
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(ARDUINO)
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "binlog.h"
+#include "utils.h"
+
+extern char LOG_PREFIX[];
+extern const char log_type_names[];
+#define LOG_NUM_TYPE_NAMES 7
+
+int OSBinLog::fd = -1;
+ulong OSBinLog::cur_day = 0;
+BinLogHeader OSBinLog::hdr;
+BinLogRecord OSBinLog::batch[BINLOG_BUFFER_SIZE];
+pthread_mutex_t OSBinLog::io_lock = PTHREAD_MUTEX_INITIALIZER;
+bool OSBinLog::swept = false;
+ulong OSBinLog::sweep_days[BINLOG_SWEEP_DAYS];
+uint16_t OSBinLog::nsweep = 0;
+BinLogRecord OSBinLog::pending[BINLOG_BUFFER_SIZE];
+uint16_t OSBinLog::npending = 0;
+bool OSBinLog::kick = false;
+bool OSBinLog::busy = false;
+pthread_mutex_t OSBinLog::lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t OSBinLog::wake = PTHREAD_COND_INITIALIZER;
+pthread_cond_t OSBinLog::done = PTHREAD_COND_INITIALIZER;
+unsigned char OSBinLog::writer_state = 0;  // 0: not started, 1: running, 2: failed to start
+ulong OSBinLog::nwritten = 0;
+ulong OSBinLog::ndropped = 0;
+ulong OSBinLog::nbatches = 0;
+
+/** Log folder, copied once from get_filename_fullpath
+ * The writer thread builds its paths from this copy: the static buffer
+ * of get_filename_fullpath is shared with the main thread.
+ * Filled by start_writer before the thread exists.
+ */
+static char binlog_dir_path[PATH_MAX];
+
+static const char* binlog_dir() {
+	if(!binlog_dir_path[0]) {
+		strncpy(binlog_dir_path, get_filename_fullpath(LOG_PREFIX), PATH_MAX-1);
+	}
+	return binlog_dir_path;
+}
+
+/** Full path of the log file of a day, with the given extension */
+static void binlog_path(char *path, ulong day, const char *ext) {
+	// a truncated path could name another file: leave it empty so that opening it fails
+	if(snprintf(path, PATH_MAX, "%s%lu.%s", binlog_dir(), day, ext) >= PATH_MAX) path[0] = 0;
+}
+
+static void binlog_header_init(BinLogHeader &h, ulong day) {
+	memset(&h, 0, sizeof(h));
+	h.magic = BINLOG_MAGIC;
+	h.version = BINLOG_VERSION;
+	h.day = day;
+}
+
+static void binlog_header_count(BinLogHeader &h, unsigned char type) {
+	h.nrecords++;
+	if(type < BINLOG_NUM_TYPES) {
+		if(h.counts[type] < 0xFFFF) h.counts[type]++;
+		h.type_mask |= (1<<type);
+	}
+}
+
+/** Append records to the text log of their day, in the format of earlier versions */
+static bool binlog_text_append(ulong day, const BinLogRecord *recs, uint16_t n) {
+	char path[PATH_MAX];
+	binlog_path(path, day, "txt");
+	FILE *file = fopen(path, "ab");
+	if(!file) return false;
+	char line[TMP_BUFFER_SIZE];
+	for(uint16_t k=0; k<n; k++) {
+		OSBinLog::format(recs[k], line, sizeof(line));
+		fputs(line, file);
+	}
+	return fclose(file) == 0;
+}
+
+/** Open (or create) the file of a day for appending */
+bool OSBinLog::open_day(ulong day) {
+	close_fd();
+	const char *dir = binlog_dir();
+	struct stat st;
+	if(stat(dir, &st)) {
+		if(mkdir(dir, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IWGRP | S_IXGRP | S_IROTH | S_IWOTH | S_IXOTH)) {
+			return false;
+		}
+	}
+	char path[PATH_MAX];
+	binlog_path(path, day, "bin");
+	if(stat(path, &st)) {
+		// first record of the day: bring back a day that has already been compressed,
+		// and copy in the text records written before the binary log existed
+		expand_day(day);
+		// text that does not convert exactly: the day stays in the text log only
+		if(!convert_day(day, false)) return false;
+	}
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if(fd < 0) return false;
+	if(pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+	   hdr.magic != BINLOG_MAGIC || hdr.version != BINLOG_VERSION) {
+		// new or unreadable file: start over
+		binlog_header_init(hdr, day);
+		if(ftruncate(fd, 0) || pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) {
+			close_fd();
+			return false;
+		}
+	}
+	cur_day = day;
+	return true;
+}
+
+void OSBinLog::close_fd() {
+	if(fd >= 0) ::close(fd);
+	fd = -1;
+}
+
+/** Write records to the files of their days; the caller holds io_lock
+ * Returns the number written, the rest are lost.
+ */
+uint16_t OSBinLog::write_batch(const BinLogRecord *recs, uint16_t n) {
+	uint16_t i = 0, written = 0;
+	while(i < n) {
+		// a run of records of the same day goes out in one write
+		ulong day = recs[i].time / 86400;
+		uint16_t j = i+1;
+		while(j < n && recs[j].time / 86400 == day) j++;
+		if(fd < 0 || day != cur_day) {
+			ulong prev_day = (fd >= 0) ? cur_day : 0;
+			// the date has changed: the previous day is complete
+			if(open_day(day) && prev_day && prev_day < day) compress_day(prev_day);
+		}
+		// the text log is kept up as well, for whatever else reads it
+		bool ok = binlog_text_append(day, recs+i, j-i);
+		if(fd >= 0 && day == cur_day) {
+			off_t offset = sizeof(hdr) + (off_t)hdr.nrecords * sizeof(BinLogRecord);
+			ssize_t len = (ssize_t)(j-i) * sizeof(BinLogRecord);
+			if(pwrite(fd, recs+i, len, offset) == len) {
+				// the records only become visible once the header counts them
+				for(uint16_t k=i; k<j; k++) binlog_header_count(hdr, recs[k].type);
+				pwrite(fd, &hdr, sizeof(hdr), 0);
+				ok = true;
+			}
+		}
+		if(ok) written += j-i;
+		i = j;
+	}
+	return written;
+}
+
+/** Compress one day of the start-up sweep; only called by the writer */
+void OSBinLog::sweep_step() {
+	pthread_mutex_lock(&io_lock);
+	if(nsweep) compress_day(sweep_days[--nsweep]);
+	pthread_mutex_unlock(&io_lock);
+}
+
+void* OSBinLog::writer(void*) {
+	pthread_mutex_lock(&lock);
+	for(;;) {
+		while(!kick) {
+			if(nsweep) {
+				// one day at a time: a sync never waits for more than one compression
+				pthread_mutex_unlock(&lock);
+				sweep_step();
+				pthread_mutex_lock(&lock);
+			} else {
+				pthread_cond_wait(&wake, &lock);
+			}
+		}
+		uint16_t n = npending;
+		memcpy(batch, pending, n * sizeof(BinLogRecord));
+		npending = 0;
+		kick = false;
+		busy = true;
+		pthread_mutex_unlock(&lock);
+
+		pthread_mutex_lock(&io_lock);
+		uint16_t written = write_batch(batch, n);
+		if(!swept && n) {
+			// days left uncompressed by an earlier run or version, compressed while idle
+			nsweep = list_days(".bin", batch[n-1].time / 86400, sweep_days, BINLOG_SWEEP_DAYS);
+			swept = true;
+		}
+		pthread_mutex_unlock(&io_lock);
+
+		pthread_mutex_lock(&lock);
+		busy = false;
+		nwritten += written;
+		ndropped += n - written;
+		nbatches++;
+		pthread_cond_broadcast(&done);
+	}
+	return NULL;
+}
+
+bool OSBinLog::start_writer() {
+	if(writer_state == 0) {
+		pthread_t tid;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		binlog_dir();
+		writer_state = (pthread_create(&tid, &attr, writer, NULL) == 0) ? 1 : 2;
+		pthread_attr_destroy(&attr);
+	}
+	return writer_state == 1;
+}
+
+/** Queue a record for the file of the day it belongs to */
+bool OSBinLog::append(const BinLogRecord &rec) {
+	if(!start_writer()) {
+		// no thread: write in place
+		pthread_mutex_lock(&io_lock);
+		bool ok = write_batch(&rec, 1) == 1;
+		pthread_mutex_unlock(&io_lock);
+		pthread_mutex_lock(&lock);
+		if(ok) nwritten++;
+		else ndropped++;
+		pthread_mutex_unlock(&lock);
+		return ok;
+	}
+	bool ok = true;
+	pthread_mutex_lock(&lock);
+	if(npending == BINLOG_BUFFER_SIZE) {
+		ndropped++;
+		ok = false;
+	} else {
+		pending[npending++] = rec;
+		if(npending >= BINLOG_FLUSH_RECORDS && !kick) {
+			kick = true;
+			pthread_cond_signal(&wake);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	return ok;
+}
+
+/** Wake the writer for records that have waited BINLOG_FLUSH_INTERVAL */
+void OSBinLog::loop(time_os_t curr_time) {
+	pthread_mutex_lock(&lock);
+	if(npending && !kick) {
+		time_os_t t = pending[0].time;
+		if(curr_time < t || curr_time - t >= BINLOG_FLUSH_INTERVAL) {
+			kick = true;
+			pthread_cond_signal(&wake);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/** Write out all queued records and wait until they are in the files */
+void OSBinLog::sync() {
+	if(writer_state != 1) return;
+	pthread_mutex_lock(&lock);
+	while(npending || kick || busy) {
+		if(npending && !kick) {
+			kick = true;
+			pthread_cond_signal(&wake);
+		}
+		pthread_cond_wait(&done, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/** Writer counters, read under the lock they are updated under */
+void OSBinLog::stats(ulong &written, ulong &dropped, ulong &batches) {
+	pthread_mutex_lock(&lock);
+	written = nwritten;
+	dropped = ndropped;
+	batches = nbatches;
+	pthread_mutex_unlock(&lock);
+}
+
+void OSBinLog::close() {
+	sync();
+	pthread_mutex_lock(&io_lock);
+	close_fd();
+	pthread_mutex_unlock(&io_lock);
+}
+
+void OSBinLog::remove_day(ulong day) {
+	// records still queued for the day would bring the file back
+	sync();
+	pthread_mutex_lock(&io_lock);
+	if(fd >= 0 && day == cur_day) close_fd();
+	char path[PATH_MAX];
+	binlog_path(path, day, "bin");
+	remove(path);
+	binlog_path(path, day, "binz");
+	remove(path);
+	binlog_path(path, day, "txt");
+	remove(path);
+	pthread_mutex_unlock(&io_lock);
+}
+
+/** Remove every day, in any format, and the log folder */
+void OSBinLog::remove_all() {
+	sync();
+	pthread_mutex_lock(&io_lock);
+	close_fd();
+	DIR *dir = opendir(binlog_dir());
+	if(dir) {
+		char path[PATH_MAX];
+		struct dirent *ent;
+		while((ent = readdir(dir)) != NULL) {
+			char *ext;
+			ulong day = strtoul(ent->d_name, &ext, 10);
+			if(ext == ent->d_name || *ext != '.') continue;
+			binlog_path(path, day, ext+1);
+			remove(path);
+		}
+		closedir(dir);
+	}
+	rmdir(binlog_dir());
+	pthread_mutex_unlock(&io_lock);
+}
+
+/** Print a record exactly as the text log stores it, including the line ending */
+int OSBinLog::format(const BinLogRecord &rec, char *buf, int size) {
+	int len;
+	if(rec.type == LOGDATA_STATION) {
+		len = snprintf(buf, size, "[%d,%d,%lu,%lu", rec.pid, rec.sid, (ulong)rec.value, (ulong)rec.time);
+		if(rec.flags & BINLOG_FLAG_FLOW) {
+			float gpm;
+			memcpy(&gpm, &rec.value2, sizeof(gpm));
+			len += snprintf(buf+len, size-len, ",%5.2f", gpm);
+		}
+	} else {
+		const char *name = log_type_names + (rec.type < LOG_NUM_TYPE_NAMES ? rec.type : 0)*3;
+		len = snprintf(buf, size, "[%lu,\"%s\",%lu,%lu", (ulong)rec.value, name, (ulong)rec.value2, (ulong)rec.time);
+	}
+	len += snprintf(buf+len, size-len, "]\r\n");
+	return len;
+}
+
+/** Record type of a special record name, or -1 if it is not one */
+int OSBinLog::type_code(const char *name) {
+	for(unsigned char i=1; i<LOG_NUM_TYPE_NAMES; i++) {
+		if(strncmp(name, log_type_names+i*3, 2) == 0) return i;
+	}
+	return -1;
+}
+
+/** Parse one text log line; succeeds only if the record prints back identically */
+static bool binlog_parse_line(const char *line, BinLogRecord &rec) {
+	char check[TMP_BUFFER_SIZE];
+	char name[3];
+	unsigned long v1, v2, t;
+	unsigned int pid, sid;
+	float gpm;
+	memset(&rec, 0, sizeof(rec));
+	if(sscanf(line, "[%lu,\"%2[^\"]\",%lu,%lu]", &v1, name, &v2, &t) == 4) {
+		int type = OSBinLog::type_code(name);
+		if(type < 0) return false;
+		rec.type = type;
+		rec.value = v1;
+		rec.value2 = v2;
+	} else {
+		int n = sscanf(line, "[%u,%u,%lu,%lu,%f]", &pid, &sid, &v1, &t, &gpm);
+		if(n < 4) return false;
+		rec.type = LOGDATA_STATION;
+		rec.pid = pid;
+		rec.sid = sid;
+		rec.value = v1;
+		if(n == 5) {
+			rec.flags |= BINLOG_FLAG_FLOW;
+			memcpy(&rec.value2, &gpm, sizeof(gpm));
+		}
+	}
+	rec.time = t;
+	OSBinLog::format(rec, check, sizeof(check));
+	return strcmp(check, line) == 0;
+}
+
+/** Copy the text log of a day into its binary log
+ * A day that has no binary log yet is converted only if every line converts
+ * exactly. The text file is kept, as the writer keeps adding to it, unless
+ * remove_text is set (the -c converter): then it is removed once the binary
+ * log holds at least as many records as it has lines.
+ * Returns whether the binary log holds the text records (true without a text file).
+ */
+bool OSBinLog::convert_day(ulong day, bool remove_text) {
+	char txt_path[PATH_MAX], bin_path[PATH_MAX], tmp_path[PATH_MAX];
+	binlog_path(txt_path, day, "txt");
+	binlog_path(bin_path, day, "bin");
+	binlog_path(tmp_path, day, "tmp");
+
+	FILE *in = fopen(txt_path, "rb");
+	if(!in) return true;
+	char line[TMP_BUFFER_SIZE];
+	BinLogReader reader;
+	if(reader.open(day)) {
+		// converted before, or written alongside by the writer
+		uint32_t nlines = 0;
+		while(fgets(line, sizeof(line), in)) nlines++;
+		fclose(in);
+		bool ok = nlines <= reader.header().nrecords;
+		if(ok && remove_text) remove(txt_path);
+		return ok;
+	}
+	FILE *out = fopen(tmp_path, "wb");
+	if(!out) {
+		fclose(in);
+		return false;
+	}
+
+	BinLogHeader h;
+	binlog_header_init(h, day);
+	fwrite(&h, sizeof(h), 1, out);
+
+	BinLogRecord rec;
+	bool ok = true;
+	while(ok && fgets(line, sizeof(line), in)) {
+		ok = binlog_parse_line(line, rec) && fwrite(&rec, sizeof(rec), 1, out) == 1;
+		if(ok) binlog_header_count(h, rec.type);
+	}
+	fclose(in);
+	if(ok) {
+		fseek(out, 0, SEEK_SET);
+		ok = fwrite(&h, sizeof(h), 1, out) == 1;
+	}
+	if(fclose(out)) ok = false;
+	if(ok && !rename(tmp_path, bin_path)) {
+		if(remove_text) remove(txt_path);
+		return true;
+	}
+	remove(tmp_path);
+	return false;
+}
+
+/** Convert all text logs and remove them; returns the number of days converted */
+int OSBinLog::convert_all() {
+	DIR *dir = opendir(binlog_dir());
+	if(!dir) return 0;
+	int converted = 0;
+	struct dirent *ent;
+	while((ent = readdir(dir)) != NULL) {
+		char *ext;
+		ulong day = strtoul(ent->d_name, &ext, 10);
+		if(ext == ent->d_name || strcmp(ext, ".txt")) continue;
+		if(convert_day(day, true)) converted++;
+	}
+	closedir(dir);
+	return converted;
+}
+
+/** Compress the log of a (complete) day into logs/<day>.binz
+ * The plain file is removed only once the compressed one is in place.
+ */
+bool OSBinLog::compress_day(ulong day) {
+	if(fd >= 0 && day == cur_day) return false;
+	char bin_path[PATH_MAX], binz_path[PATH_MAX], tmp_path[PATH_MAX];
+	binlog_path(bin_path, day, "bin");
+	binlog_path(binz_path, day, "binz");
+	binlog_path(tmp_path, day, "ztmp");
+
+	FILE *in = fopen(bin_path, "rb");
+	if(!in) return false;
+	BinLogHeader h;
+	if(fread(&h, sizeof(h), 1, in) != 1 || h.magic != BINLOG_MAGIC || h.version != BINLOG_VERSION) {
+		fclose(in);
+		return false;
+	}
+	FILE *out = fopen(tmp_path, "wb");
+	if(!out) {
+		fclose(in);
+		return false;
+	}
+	BinLogHeader zh = h;
+	zh.magic = BINLOGZ_MAGIC;
+	bool ok = fwrite(&zh, sizeof(zh), 1, out) == 1;
+
+	// only used under io_lock
+	static BinLogRecord recs[BINLOG_READ_BATCH];
+	static Bytef zbuf[BINLOG_ZBUF_SIZE];
+	uint32_t remaining = h.nrecords;
+	while(ok && remaining) {
+		uint32_t want = remaining < BINLOG_READ_BATCH ? remaining : BINLOG_READ_BATCH;
+		size_t got = fread(recs, sizeof(BinLogRecord), want, in);
+		if(got == 0) break;  // fewer records than counted: keep what is there
+		uLongf zlen = sizeof(zbuf);
+		uint32_t len32;
+		ok = compress2(zbuf, &zlen, (const Bytef*)recs, got*sizeof(BinLogRecord), Z_DEFAULT_COMPRESSION) == Z_OK;
+		len32 = zlen;
+		ok = ok && fwrite(&len32, sizeof(len32), 1, out) == 1 && fwrite(zbuf, zlen, 1, out) == 1;
+		remaining -= got;
+	}
+	fclose(in);
+	if(ok && remaining) {
+		// rewrite the header with the records actually stored
+		zh.nrecords -= remaining;
+		ok = !fseek(out, 0, SEEK_SET) && fwrite(&zh, sizeof(zh), 1, out) == 1;
+	}
+	if(fclose(out)) ok = false;
+	if(ok && !rename(tmp_path, binz_path)) {
+		remove(bin_path);
+		return true;
+	}
+	remove(tmp_path);
+	return false;
+}
+
+/** Days before a day that have a file with the given extension, at most max
+ * Collected first, as converting or compressing changes the directory being read.
+ */
+int OSBinLog::list_days(const char *ext, ulong before_day, ulong *days, int max) {
+	DIR *dir = opendir(binlog_dir());
+	if(!dir) return 0;
+	int ndays = 0;
+	struct dirent *ent;
+	while(ndays < max && (ent = readdir(dir)) != NULL) {
+		char *end;
+		ulong day = strtoul(ent->d_name, &end, 10);
+		if(end == ent->d_name || strcmp(end, ext) || day >= before_day) continue;
+		days[ndays++] = day;
+	}
+	closedir(dir);
+	return ndays;
+}
+
+/** Compress the plain logs of all days before a day; returns the number compressed */
+int OSBinLog::compress_all(ulong before_day) {
+	ulong days[BINLOG_SWEEP_DAYS];
+	int ndays = list_days(".bin", before_day, days, BINLOG_SWEEP_DAYS);
+	int compressed = 0;
+	for(int i=0; i<ndays; i++) {
+		if(compress_day(days[i])) compressed++;
+	}
+	return compressed;
+}
+
+/** Turn a compressed day back into a plain file, so that records can be appended */
+bool OSBinLog::expand_day(ulong day) {
+	char bin_path[PATH_MAX], binz_path[PATH_MAX], tmp_path[PATH_MAX];
+	binlog_path(bin_path, day, "bin");
+	binlog_path(binz_path, day, "binz");
+	binlog_path(tmp_path, day, "tmp");
+	BinLogReader reader;
+	if(!reader.open(day)) return false;
+	FILE *out = fopen(tmp_path, "wb");
+	if(!out) return false;
+	BinLogHeader h;
+	binlog_header_init(h, day);
+	bool ok = fwrite(&h, sizeof(h), 1, out) == 1;
+	const BinLogRecord *rec;
+	while(ok && (rec = reader.next()) != NULL) {
+		ok = fwrite(rec, sizeof(*rec), 1, out) == 1;
+		binlog_header_count(h, rec->type);
+	}
+	if(ok) ok = !fseek(out, 0, SEEK_SET) && fwrite(&h, sizeof(h), 1, out) == 1;
+	if(fclose(out)) ok = false;
+	if(ok && !rename(tmp_path, bin_path)) {
+		remove(binz_path);
+		return true;
+	}
+	remove(tmp_path);
+	return false;
+}
+
+bool BinLogReader::open(ulong day) {
+	close();
+	char path[PATH_MAX];
+	binlog_path(path, day, "bin");
+	fd = ::open(path, O_RDONLY);
+	compressed = false;
+	if(fd < 0) {
+		binlog_path(path, day, "binz");
+		fd = ::open(path, O_RDONLY);
+		if(fd < 0) return false;
+		compressed = true;
+	}
+	if(::read(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr) ||
+	   hdr.magic != (compressed ? BINLOGZ_MAGIC : BINLOG_MAGIC) || hdr.version != BINLOG_VERSION) {
+		close();
+		return false;
+	}
+	remaining = hdr.nrecords;
+	n = pos = 0;
+	return true;
+}
+
+void BinLogReader::close() {
+	if(fd >= 0) ::close(fd);
+	fd = -1;
+}
+
+const BinLogRecord* BinLogReader::next() {
+	if(pos == n) {
+		if(fd < 0 || remaining == 0) return NULL;
+		if(compressed) {
+			// one block: its length, then the deflated records
+			uint32_t zlen;
+			uLongf len = sizeof(buf);
+			n = 0;
+			if(::read(fd, &zlen, sizeof(zlen)) == (ssize_t)sizeof(zlen) && zlen <= sizeof(zbuf) &&
+			   ::read(fd, zbuf, zlen) == (ssize_t)zlen &&
+			   uncompress((Bytef*)buf, &len, zbuf, zlen) == Z_OK) {
+				n = len / sizeof(BinLogRecord);
+				if(n > remaining) n = remaining;
+			}
+		} else {
+			uint32_t want = remaining < BINLOG_READ_BATCH ? remaining : BINLOG_READ_BATCH;
+			ssize_t r = ::read(fd, buf, want * sizeof(BinLogRecord));
+			n = (r > 0) ? r / sizeof(BinLogRecord) : 0;
+		}
+		if(n == 0) {
+			remaining = 0;
+			return NULL;
+		}
+		remaining -= n;
+		pos = 0;
+	}
+	return &buf[pos++];
+}
+
+#endif
@@ -0,0 +1,163 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Binary log store header file
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BINLOG_H
+#define _BINLOG_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include <pthread.h>
+#include "defines.h"
+#include "types.h"
+
+#define BINLOG_MAGIC       0x4C42534F  // "OSBL"
+#define BINLOGZ_MAGIC      0x5A42534F  // "OSBZ": compressed day
+#define BINLOG_VERSION     1
+#define BINLOG_NUM_TYPES   16          // record types tracked in the day header
+#define BINLOG_READ_BATCH  256         // records read per system call, and per compressed block
+#define BINLOG_ZBUF_SIZE   (BINLOG_READ_BATCH*16+64)  // room for a deflated block (compressBound)
+#define BINLOG_BUFFER_SIZE 512         // records waiting for the writer; more are dropped
+#define BINLOG_FLUSH_RECORDS  32       // wake the writer once this many records wait
+#define BINLOG_FLUSH_INTERVAL 5        // or once the oldest has waited this many seconds
+#define BINLOG_SWEEP_DAYS  512         // old days compressed by the start-up sweep
+
+#define BINLOG_FLAG_FLOW   0x01        // station record carries a flow rate
+
+/** Per-day file header
+ * Holds the record count and a per-type count and bitmap, so that queries
+ * can skip a day, or a type, without reading the records.
+ */
+struct BinLogHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t type_mask;   // bit n set if the day has records of type n
+	uint32_t day;         // epoch time / 86400
+	uint32_t nrecords;
+	uint16_t counts[BINLOG_NUM_TYPES];
+};
+
+/** Fixed-size log record
+ * Station records:  [pid,sid,value,time(,flow)]
+ * Special records:  [value,"type",value2,time]
+ */
+struct BinLogRecord {
+	uint32_t time;
+	uint32_t value;
+	uint32_t value2;  // second value, or the flow rate (float) of a station record
+	unsigned char type;
+	unsigned char pid;
+	unsigned char sid;
+	unsigned char flags;
+};
+
+/** Compressed day (logs/<day>.binz)
+ * The header as in the .bin file (with BINLOGZ_MAGIC), so a query can still
+ * skip the day unread, followed by blocks of up to BINLOG_READ_BATCH records,
+ * each stored as a uint32_t length and the zlib-deflated records.
+ */
+
+/** Day-sharded binary log files (logs/<day>.bin)
+ * append only queues the record in memory; a background writer thread
+ * writes the queue out in batches (one write per day touched, then the
+ * header), so a slow SD card never holds up the control loop. The file
+ * of the current day stays open between batches.
+ * Past days are compressed by the writer: the previous day when the date
+ * changes, and any others still uncompressed after its first batch, one
+ * day at a time while no batch is waiting. A record
+ * for a compressed day (e.g. after a clock change) expands the day again.
+ * The writer also appends each record to the text log (logs/<day>.txt) as
+ * earlier versions did, so other readers of it keep working. The first
+ * record of a day copies in the text records it already has, so the
+ * binary log of a day always holds all of them; /jl reads the text log
+ * only for days without one. convert_all (OpenSprinkler -c) moves the text
+ * logs into the binary format and removes them.
+ */
+class OSBinLog {
+public:
+	static bool append(const BinLogRecord &rec);
+	static void loop(time_os_t curr_time);
+	static void sync();
+	static void close();
+	static void remove_day(ulong day);
+	static void remove_all();
+	static int format(const BinLogRecord &rec, char *buf, int size);
+	static int type_code(const char *name);
+	static bool convert_day(ulong day, bool remove_text);
+	static int convert_all();
+	static bool compress_day(ulong day);
+	static int compress_all(ulong before_day);
+
+	static void stats(ulong &written, ulong &dropped, ulong &batches);
+
+private:
+	// owned by the writer, or by whoever holds io_lock
+	static int fd;
+	static ulong cur_day;
+	static BinLogHeader hdr;
+	static BinLogRecord batch[];
+	static pthread_mutex_t io_lock;
+	static bool swept;  // whether the old days to compress have been listed since the start
+	static ulong sweep_days[];
+	static uint16_t nsweep;
+	// shared with the writer under lock
+	static BinLogRecord pending[];
+	static uint16_t npending;
+	static bool kick, busy;
+	static ulong nwritten;  // records written to the files
+	static ulong ndropped;  // records lost to a full buffer or a failed write
+	static ulong nbatches;  // writer wake-ups
+	static pthread_mutex_t lock;
+	static pthread_cond_t wake, done;
+	static unsigned char writer_state;
+	static bool start_writer();
+	static void* writer(void*);
+	static void sweep_step();
+	static uint16_t write_batch(const BinLogRecord *recs, uint16_t n);
+	static int list_days(const char *ext, ulong before_day, ulong *days, int max);
+	static bool open_day(ulong day);
+	static bool expand_day(ulong day);
+	static void close_fd();
+};
+
+/** Sequential reader for one day of binary records, plain or compressed */
+class BinLogReader {
+public:
+	BinLogReader() : fd(-1) {}
+	~BinLogReader() { close(); }
+	bool open(ulong day);
+	void close();
+	const BinLogHeader& header() const { return hdr; }
+	const BinLogRecord* next();
+private:
+	int fd;
+	bool compressed;
+	BinLogHeader hdr;
+	BinLogRecord buf[BINLOG_READ_BATCH];
+	unsigned char zbuf[BINLOG_ZBUF_SIZE];
+	uint32_t remaining;
+	uint16_t n, pos;
+};
+
+#endif
+
+#endif // _BINLOG_H
@@ -3,7 +3,7 @@ set -e
 
 DEBUG=""
 
-while getopts ":s:d" opt; do
+while getopts ":s:dm" opt; do
   case $opt in
     s)
 	  SILENT=true
@@ -13,6 +13,10 @@ while getopts ":s:d" opt; do
       DEBUG="-DENABLE_DEBUG -DSERIAL_DEBUG"
 	  command shift
       ;;
+    m)
+      USEGPIOMEM=true
+	  command shift
+      ;;
   esac
 done
 echo "Building OpenSprinkler..."
@@ -29,24 +33,32 @@ fi
 
 if [ "$1" == "demo" ]; then
 	echo "Installing required libraries..."
-	apt-get install -y libmosquitto-dev libssl-dev
+	apt-get install -y libmosquitto-dev libssl-dev zlib1g-dev
 	echo "Compiling demo firmware..."
 
     ws=$(ls external/TinyWebsockets/tiny_websockets_lib/src/*.cpp)
     otf=$(ls external/OpenThings-Framework-Firmware-Library/*.cpp)
-    g++ -o OpenSprinkler -DDEMO -DSMTP_OPENSSL $DEBUG -std=c++14 -include string.h main.cpp OpenSprinkler.cpp program.cpp opensprinkler_server.cpp utils.cpp weather.cpp gpio.cpp mqtt.cpp smtp.c -Iexternal/TinyWebsockets/tiny_websockets_lib/include $ws -Iexternal/OpenThings-Framework-Firmware-Library/ $otf -lpthread -lmosquitto -lssl -lcrypto
+    g++ -o OpenSprinkler -DDEMO -DSMTP_OPENSSL $DEBUG -std=c++14 -include string.h main.cpp OpenSprinkler.cpp program.cpp opensprinkler_server.cpp utils.cpp weather.cpp gpio.cpp mqtt.cpp httpclient.cpp telemetry.cpp binlog.cpp rollup.cpp reactor.cpp smtp.c -Iexternal/TinyWebsockets/tiny_websockets_lib/include $ws -Iexternal/OpenThings-Framework-Firmware-Library/ $otf -lpthread -lmosquitto -lssl -lcrypto -lz
+elif [ "$1" == "sim" ]; then
+	echo "Installing required libraries..."
+	apt-get install -y libmosquitto-dev libssl-dev zlib1g-dev
+	echo "Compiling simulation firmware..."
+
+    ws=$(ls external/TinyWebsockets/tiny_websockets_lib/src/*.cpp)
+    otf=$(ls external/OpenThings-Framework-Firmware-Library/*.cpp)
+    g++ -o OpenSprinkler -DDEMO -DSIMULATION -DSMTP_OPENSSL $DEBUG -std=c++14 -include string.h main.cpp OpenSprinkler.cpp program.cpp opensprinkler_server.cpp utils.cpp weather.cpp gpio.cpp mqtt.cpp httpclient.cpp telemetry.cpp binlog.cpp rollup.cpp reactor.cpp sim.cpp smtp.c -Iexternal/TinyWebsockets/tiny_websockets_lib/include $ws -Iexternal/OpenThings-Framework-Firmware-Library/ $otf -lpthread -lmosquitto -lssl -lcrypto -lz
 elif [ "$1" == "osbo" ]; then
 	echo "Installing required libraries..."
-	apt-get install -y libmosquitto-dev libssl-dev
+	apt-get install -y libmosquitto-dev libssl-dev zlib1g-dev
 	echo "Compiling osbo firmware..."
 
     ws=$(ls external/TinyWebsockets/tiny_websockets_lib/src/*.cpp)
     otf=$(ls external/OpenThings-Framework-Firmware-Library/*.cpp)
-	g++ -o OpenSprinkler -DOSBO -DSMTP_OPENSSL $DEBUG -std=c++14 -include string.h main.cpp OpenSprinkler.cpp program.cpp opensprinkler_server.cpp utils.cpp weather.cpp gpio.cpp mqtt.cpp smtp.c -Iexternal/TinyWebsockets/tiny_websockets_lib/include $ws -Iexternal/OpenThings-Framework-Firmware-Library/ $otf -lpthread -lmosquitto -lssl -lcrypto
+	g++ -o OpenSprinkler -DOSBO -DSMTP_OPENSSL $DEBUG -std=c++14 -include string.h main.cpp OpenSprinkler.cpp program.cpp opensprinkler_server.cpp utils.cpp weather.cpp gpio.cpp mqtt.cpp httpclient.cpp telemetry.cpp binlog.cpp rollup.cpp reactor.cpp smtp.c -Iexternal/TinyWebsockets/tiny_websockets_lib/include $ws -Iexternal/OpenThings-Framework-Firmware-Library/ $otf -lpthread -lmosquitto -lssl -lcrypto -lz
 else
 	echo "Installing required libraries..."
 	apt-get update
-	apt-get install -y libmosquitto-dev raspi-gpio libi2c-dev libssl-dev libgpiod-dev
+	apt-get install -y libmosquitto-dev raspi-gpio libi2c-dev libssl-dev libgpiod-dev zlib1g-dev
 	if ! command -v raspi-gpio &> /dev/null
 	then
 		echo "Command raspi-gpio is required and is not installed"
@@ -63,10 +75,16 @@ else
 		GPIOLIB="-lgpiod"
 	fi
 
+	if [ "$USEGPIOMEM" = true ]; then
+		echo "using /dev/gpiomem"
+		USEGPIO="-DGPIOMEM"
+		GPIOLIB=""
+	fi
+
 	echo "Compiling ospi firmware..."
     ws=$(ls external/TinyWebsockets/tiny_websockets_lib/src/*.cpp)
     otf=$(ls external/OpenThings-Framework-Firmware-Library/*.cpp)
-	g++ -o OpenSprinkler -DOSPI $USEGPIO -DSMTP_OPENSSL $DEBUG -std=c++14 -include string.h main.cpp OpenSprinkler.cpp program.cpp opensprinkler_server.cpp utils.cpp weather.cpp gpio.cpp mqtt.cpp smtp.c -Iexternal/TinyWebsockets/tiny_websockets_lib/include $ws -Iexternal/OpenThings-Framework-Firmware-Library/ $otf -lpthread -lmosquitto -lssl -lcrypto $GPIOLIB
+	g++ -o OpenSprinkler -DOSPI $USEGPIO -DSMTP_OPENSSL $DEBUG -std=c++14 -include string.h main.cpp OpenSprinkler.cpp program.cpp opensprinkler_server.cpp utils.cpp weather.cpp gpio.cpp mqtt.cpp httpclient.cpp telemetry.cpp binlog.cpp rollup.cpp reactor.cpp smtp.c -Iexternal/TinyWebsockets/tiny_websockets_lib/include $ws -Iexternal/OpenThings-Framework-Firmware-Library/ $otf -lpthread -lmosquitto -lssl -lcrypto -lz $GPIOLIB
 fi
 
 if [ -f /etc/init.d/OpenSprinkler.sh ]; then
@@ -136,6 +136,10 @@ typedef unsigned long ulong;
 #define STATION_NAME_SIZE 32    // maximum number of characters in each station name
 #define MAX_SOPTS_SIZE    320   // maximum string option size
 
+#define SESSION_MAX        8    // session tokens held at a time (see /jt)
+#define SESSION_TTL        900  // seconds a session token stays valid
+#define SESSION_TOKEN_LEN  32   // hex digits in a session token
+
 #define STATION_SPECIAL_DATA_SIZE  (TMP_BUFFER_SIZE - STATION_NAME_SIZE - 12)
 
 /** Default string option values */
@@ -282,6 +286,7 @@ enum {
 	SOPT_DEVICE_NAME,
 	SOPT_STA_BSSID_CHL, // wifi extra info: bssid and channel
 	SOPT_EMAIL_OPTS,
+	SOPT_INFLUX_OPTS, // valve telemetry endpoint (Linux only)
 	NUM_SOPTS // total number of string options
 };
 
@@ -177,7 +177,175 @@ unsigned char digitalReadExt(unsigned char pin) {
 
 #elif defined(OSPI) || defined(OSBO)
 
-#if !defined(LIBGPIOD)	// use classic sysfs
+#if defined(GPIOMEM) && defined(OSPI)	// use memory-mapped registers through /dev/gpiomem
+
+/**
+ * BCM283x GPIO registers, mapped through /dev/gpiomem
+ * (no root needed). Pins are driven with single stores to the
+ * set/clear registers, which makes the shift register output
+ * considerably faster than through sysfs or libgpiod.
+ *
+ * If /dev/gpiomem is not available (e.g. not a Raspberry Pi, or a
+ * Pi 5 whose GPIO is on the RP1 chip), the pins do nothing and an
+ * error is printed. Only DEMO, SIMULATION, BENCHMARK and UNITTEST
+ * builds use a simulated register file instead. It also models the
+ * 74HC595 chain behind the PIN_SR_* pins, so the shift-out can be
+ * checked without hardware.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(DEMO) || defined(SIMULATION) || defined(BENCHMARK) || defined(UNITTEST)
+#define GPIOMEM_SIM    // a simulated register file stands in for a missing /dev/gpiomem
+#endif
+
+#define BUFFER_MAX     64
+#define GPIO_MAX       54
+#define GPIOMEM_SIZE   4096
+
+// register word offsets
+#define GPFSEL0        0
+#define GPSET0         7
+#define GPCLR0        10
+#define GPLEV0        13
+
+static volatile uint32_t *gpio_regs = NULL;
+
+#if defined(GPIOMEM_SIM)
+static bool gpio_simulated = false;
+static uint32_t gpio_sim_regs[GPIOMEM_SIZE/4];
+static unsigned char gpio_sim_shift[MAX_NUM_BOARDS];   // bits shifted in, not yet latched
+static unsigned char gpio_sim_latched[MAX_NUM_BOARDS]; // shift register outputs
+#endif
+
+static bool gpiomem_map() {
+	if(gpio_regs) return true;
+	int fd = open("/dev/gpiomem", O_RDWR | O_SYNC | O_CLOEXEC);
+	int err = errno;
+	if(fd >= 0) {
+		void *p = mmap(NULL, GPIOMEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		err = errno;
+		close(fd);
+		if(p != MAP_FAILED) {
+			gpio_regs = (volatile uint32_t *)p;
+			return true;
+		}
+	}
+#if defined(GPIOMEM_SIM)
+	DEBUG_PRINTLN("/dev/gpiomem not available, using simulated GPIO registers");
+	(void)err;
+	gpio_regs = gpio_sim_regs;
+	gpio_simulated = true;
+	return true;
+#else
+	// the valves cannot be driven: say so once, rather than run as if they were
+	static bool reported = false;
+	if(!reported) {
+		fprintf(stderr, "GPIO: cannot map /dev/gpiomem (%s), station outputs are disabled\n", strerror(err));
+		reported = true;
+	}
+	return false;
+#endif
+}
+
+/** Whether the GPIO registers can be used; checked once at start-up */
+bool gpiomem_available() {
+	return gpiomem_map();
+}
+
+#if defined(GPIOMEM_SIM)
+/** Simulated 74HC595 chain: clock shifts in, latch copies to outputs */
+static void gpio_sim_edge(int pin) {
+	if(pin == PIN_SR_CLOCK) {
+		uint32_t lev = gpio_sim_regs[GPLEV0];
+		unsigned char bit = ((lev >> PIN_SR_DATA) | (lev >> PIN_SR_DATA_ALT)) & 1;
+		// the first bit shifted in ends up at the far end of the chain
+		for(int i = MAX_NUM_BOARDS-1; i > 0; i--) {
+			gpio_sim_shift[i] = (gpio_sim_shift[i] << 1) | (gpio_sim_shift[i-1] >> 7);
+		}
+		gpio_sim_shift[0] = (gpio_sim_shift[0] << 1) | bit;
+	} else if(pin == PIN_SR_LATCH) {
+		memcpy(gpio_sim_latched, gpio_sim_shift, MAX_NUM_BOARDS);
+	}
+}
+
+/** Latched shift register outputs of the simulated chain, one byte per board */
+const unsigned char* gpiomem_sim_outputs() {
+	return gpio_simulated ? gpio_sim_latched : NULL;
+}
+#else
+const unsigned char* gpiomem_sim_outputs() {
+	return NULL;
+}
+#endif
+
+/** Set pin mode, in or out */
+void pinMode(int pin, unsigned char mode) {
+	if(pin < 0 || pin >= GPIO_MAX || !gpiomem_map()) return;
+	volatile uint32_t *fsel = gpio_regs + GPFSEL0 + pin/10;
+	unsigned char shift = (pin%10)*3;
+	uint32_t v = *fsel & ~(7u << shift);
+	if(mode == OUTPUT) v |= (1u << shift);
+	*fsel = v;
+#if defined(GPIOMEM_SIM)
+	if(mode == INPUT_PULLUP && gpio_simulated) {
+		// an open input reads high
+		gpio_sim_regs[GPLEV0 + pin/32] |= 1u << (pin%32);
+		return;
+	}
+#endif
+	if(mode == INPUT_PULLUP) {
+		char cmd[BUFFER_MAX];
+		snprintf(cmd, BUFFER_MAX, "raspi-gpio set %d pu", pin);
+		system(cmd);
+	}
+}
+
+/** Read digital value */
+unsigned char digitalRead(int pin) {
+	if(pin < 0 || pin >= GPIO_MAX || !gpiomem_map()) return 0;
+	return (gpio_regs[GPLEV0 + pin/32] >> (pin%32)) & 1;
+}
+
+/** Write digital value */
+void digitalWrite(int pin, unsigned char value) {
+	if(pin < 0 || pin >= GPIO_MAX || !gpiomem_map()) return;
+	uint32_t mask = 1u << (pin%32);
+#if defined(GPIOMEM_SIM)
+	if(gpio_simulated) {
+		// the level register follows the set/clear writes
+		uint32_t old = gpio_sim_regs[GPLEV0 + pin/32];
+		if(value == LOW) gpio_sim_regs[GPLEV0 + pin/32] = old & ~mask;
+		else gpio_sim_regs[GPLEV0 + pin/32] = old | mask;
+		if(value != LOW && !(old & mask)) gpio_sim_edge(pin);
+		return;
+	}
+#endif
+	gpio_regs[(value == LOW ? GPCLR0 : GPSET0) + pin/32] = mask;
+}
+
+/** The pin number serves as the handle */
+int gpio_fd_open(int pin, int mode) {
+	return pin;
+}
+
+void gpio_fd_close(int fd) {}
+
+void gpio_write(int fd, unsigned char value) {
+	digitalWrite(fd, value);
+}
+
+// edge events need the sysfs or gpiod interface; the flow sensor is polled instead
+bool attachInterrupt(int pin, const char* mode, void (*isr)(void)) {return false;}
+
+#elif !defined(LIBGPIOD)	// use classic sysfs
 
 #include <sys/types.h>
 #include <sys/ioctl.h>
@@ -192,6 +360,17 @@ unsigned char digitalReadExt(unsigned char pin) {
 #define BUFFER_MAX 64
 #define GPIO_MAX	 64
 
+#if defined(BENCHMARK)
+// the bench build points this at a scratch tree (see gpio_sysfs_dir)
+static const char *gpio_sysfs = "/sys/class/gpio";
+
+void gpio_sysfs_dir(const char *dir) {
+	gpio_sysfs = dir;
+}
+#else
+#define gpio_sysfs "/sys/class/gpio"
+#endif
+
 // GPIO file descriptors
 static int sysFds[GPIO_MAX] = {
 	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
@@ -200,6 +379,15 @@ static int sysFds[GPIO_MAX] = {
 	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
 } ;
 
+// Cached value file descriptors for digitalRead/digitalWrite,
+// opened by pinMode and kept open until the pin is exported again
+static int valueFds[GPIO_MAX] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+} ;
+
 // Interrupt service routine functions
 static void (*isrFunctions [GPIO_MAX])(void);
 
@@ -211,7 +399,8 @@ static unsigned char GPIOExport(int pin) {
 	char buffer[BUFFER_MAX];
 	int fd, len;
 
-	fd = open("/sys/class/gpio/export", O_WRONLY);
+	snprintf(buffer, sizeof(buffer), "%s/export", gpio_sysfs);
+	fd = open(buffer, O_WRONLY);
 	if (fd < 0) {
 		DEBUG_PRINTLN("failed to open export for writing");
 		return 0;
@@ -229,7 +418,8 @@ static unsigned char GPIOUnexport(int pin) {
 	char buffer[BUFFER_MAX];
 	int fd, len;
 
-	fd = open("/sys/class/gpio/unexport", O_WRONLY);
+	snprintf(buffer, sizeof(buffer), "%s/unexport", gpio_sysfs);
+	fd = open(buffer, O_WRONLY);
 	if (fd < 0) {
 		DEBUG_PRINTLN("failed to open unexport for writing");
 		return 0;
@@ -247,7 +437,7 @@ static unsigned char GPIOSetEdge(int pin, const char *edge) {
 	char path[BUFFER_MAX];
 	int fd;
 
-	snprintf(path, BUFFER_MAX, "/sys/class/gpio/gpio%d/edge", pin);
+	snprintf(path, BUFFER_MAX, "%s/gpio%d/edge", gpio_sysfs, pin);
 
 	fd = open(path, O_WRONLY);
 	if (fd < 0) {
@@ -266,10 +456,15 @@ void pinMode(int pin, unsigned char mode) {
 	char path[BUFFER_MAX];
 	int fd;
 
-	snprintf(path, BUFFER_MAX, "/sys/class/gpio/gpio%d/direction", pin);
+	snprintf(path, BUFFER_MAX, "%s/gpio%d/direction", gpio_sysfs, pin);
 
 	struct stat st;
 	if(stat(path, &st)) {
+		// a new export has a new value file
+		if(pin>=0 && pin<GPIO_MAX && valueFds[pin]>=0) {
+			close(valueFds[pin]);
+			valueFds[pin] = -1;
+		}
 		if (!GPIOExport(pin)) return;
 	}
 
@@ -285,7 +480,10 @@ void pinMode(int pin, unsigned char mode) {
 	}
 
 	close(fd);
-#if defined(OSPI)
+	if(pin>=0 && pin<GPIO_MAX && valueFds[pin]<0) {
+		valueFds[pin] = gpio_fd_open(pin, O_RDWR);
+	}
+#if defined(OSPI) && !defined(BENCHMARK)
 	if(mode==INPUT_PULLUP) {
 		char cmd[BUFFER_MAX];
 		//snprintf(cmd, BUFFER_MAX, "gpio -g mode %d up", pin);
@@ -301,7 +499,7 @@ int gpio_fd_open(int pin, int mode) {
 	char path[BUFFER_MAX];
 	int fd;
 
-	snprintf(path, BUFFER_MAX, "/sys/class/gpio/gpio%d/value", pin);
+	snprintf(path, BUFFER_MAX, "%s/gpio%d/value", gpio_sysfs, pin);
 	fd = open(path, mode);
 	if (fd < 0) {
 		DEBUG_PRINTLN("failed to open gpio");
@@ -319,6 +517,15 @@ void gpio_fd_close(int fd) {
 unsigned char digitalRead(int pin) {
 	char value_str[3];
 
+	if(pin>=0 && pin<GPIO_MAX && valueFds[pin]>=0) {
+		// sysfs regenerates the value on every read from offset 0
+		if (pread(valueFds[pin], value_str, 3, 0) < 0) {
+			DEBUG_PRINTLN("failed to read value");
+			return 0;
+		}
+		return atoi(value_str);
+	}
+
 	int fd = gpio_fd_open(pin, O_RDONLY);
 	if (fd < 0) {
 		return 0;
@@ -344,6 +551,14 @@ void gpio_write(int fd, unsigned char value) {
 
 /** Write digital value */
 void digitalWrite(int pin, unsigned char value) {
+	if(pin>=0 && pin<GPIO_MAX && valueFds[pin]>=0) {
+		static const char value_str[] = "01";
+		if (1 != pwrite(valueFds[pin], &value_str[LOW==value?0:1], 1, 0)) {
+			DEBUG_PRINT("failed to write value on pin ");
+		}
+		return;
+	}
+
 	int fd = gpio_fd_open(pin);
 	if (fd < 0) {
 		return;
@@ -405,24 +620,24 @@ static void *interruptHandler (void *arg) {
 
 #include "utils.h"
 /** Attach an interrupt function to pin */
-void attachInterrupt(int pin, const char* mode, void (*isr)(void)) {
-	if((pin<0)||(pin>GPIO_MAX)) {
+bool attachInterrupt(int pin, const char* mode, void (*isr)(void)) {
+	if((pin<0)||(pin>=GPIO_MAX)) {
 		DEBUG_PRINTLN("pin out of range");
-		return;
+		return false;
 	}
 
 	// set pin to INPUT mode and set interrupt edge mode
 	pinMode(pin, INPUT);
-	GPIOSetEdge(pin, mode);
+	if(!GPIOSetEdge(pin, mode)) return false;
 
 	char path[BUFFER_MAX];
-	snprintf(path, BUFFER_MAX, "/sys/class/gpio/gpio%d/value", pin);
+	snprintf(path, BUFFER_MAX, "%s/gpio%d/value", gpio_sysfs, pin);
 
 	// open gpio file
 	if(sysFds[pin]==-1) {
 		if((sysFds[pin]=open(path, O_RDWR))<0) {
 			DEBUG_PRINTLN("failed to open gpio value for reading");
-			return;
+			return false;
 		}
 	}
 
@@ -439,10 +654,15 @@ void attachInterrupt(int pin, const char* mode, void (*isr)(void)) {
 	pthread_t threadId ;
 	pthread_mutex_lock (&pinMutex) ;
 		pinPass = pin ;
-		pthread_create (&threadId, NULL, interruptHandler, NULL) ;
+		if (pthread_create (&threadId, NULL, interruptHandler, NULL) != 0) {
+			pinPass = -1 ;
+			pthread_mutex_unlock (&pinMutex) ;
+			return false ;
+		}
 		while (pinPass != -1)
 			delay(1) ;
 	pthread_mutex_unlock (&pinMutex) ;
+	return true;
 }
 #else // use GPIOD
 
@@ -623,7 +843,7 @@ void digitalWrite(int pin, unsigned char value) {
 	}
 }
 
-void attachInterrupt(int pin, const char* mode, void (*isr)(void)) {}
+bool attachInterrupt(int pin, const char* mode, void (*isr)(void)) {return false;}
 void gpio_write(int fd, unsigned char value) {}
 int gpio_fd_open(int pin, int mode) {return 0;}
 void gpio_fd_close(int fd) {}
@@ -635,7 +855,7 @@ void gpio_fd_close(int fd) {}
 void pinMode(int pin, unsigned char mode) {}
 void digitalWrite(int pin, unsigned char value) {}
 unsigned char digitalRead(int pin) {return 0;}
-void attachInterrupt(int pin, const char* mode, void (*isr)(void)) {}
+bool attachInterrupt(int pin, const char* mode, void (*isr)(void)) {return false;}
 int gpio_fd_open(int pin, int mode) {return 0;}
 void gpio_fd_close(int fd) {}
 void gpio_write(int fd, unsigned char value) {}
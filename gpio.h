@@ -141,7 +141,15 @@ void gpio_fd_close(int fd);
 void gpio_write(int fd, unsigned char value);
 unsigned char digitalRead(int pin);
 // mode can be any of 'rising', 'falling', 'both'
-void attachInterrupt(int pin, const char* mode, void (*isr)(void));
+// returns false if edge events are not available for the pin
+bool attachInterrupt(int pin, const char* mode, void (*isr)(void));
+#if defined(BENCHMARK) && (defined(OSPI) || defined(OSBO)) && !defined(GPIOMEM) && !defined(LIBGPIOD)
+void gpio_sysfs_dir(const char *dir);
+#endif
+#if defined(GPIOMEM)
+bool gpiomem_available();
+const unsigned char* gpiomem_sim_outputs();
+#endif
 
 #endif
 
@@ -0,0 +1,476 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Asynchronous HTTP client
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(ARDUINO)
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "httpclient.h"
+#include "utils.h"
+
+#define HTTP_SLOT_FREE       0
+#define HTTP_SLOT_WAITING    1  // waiting for an earlier request to the same server
+#define HTTP_SLOT_RESOLVING  2
+#define HTTP_SLOT_CONNECTING 3
+#define HTTP_SLOT_HANDSHAKE  4
+#define HTTP_SLOT_SENDING    5
+#define HTTP_SLOT_RECEIVING  6
+
+#define HTTP_EV_RESOLVER     0xFF  // epoll tag of the resolver pipe
+
+struct HTTPSlot {
+	unsigned char state;
+	uint32_t gen;     // incremented each time the slot is released
+	ulong seq;        // submission order
+	char host[HTTP_ASYNC_HOST_SIZE];
+	uint16_t port;
+	bool usessl;
+	uint16_t timeout;
+	ulong deadline;
+	char *req;
+	size_t reqlen;
+	size_t sent;
+	char *resp;
+	uint16_t resplen;
+	int fd;
+	SSL *ssl;
+	void (*callback)(char *);
+	void (*done)(int8_t);
+};
+
+/** Name resolution job, handed to a helper thread and back through a pipe */
+struct HTTPResolveJob {
+	unsigned char idx;
+	uint32_t gen;
+	char host[HTTP_ASYNC_HOST_SIZE];
+	char port[6];
+	int err;
+	struct addrinfo *res;
+};
+
+/** Request that arrived while all slots were taken; moved into a slot once one is free */
+struct HTTPQueued {
+	HTTPSlot slot;
+	HTTPQueued *next;
+};
+
+static HTTPSlot slots[HTTP_ASYNC_MAX_REQUESTS];
+static HTTPQueued *overflow_head = NULL;
+static HTTPQueued *overflow_tail = NULL;
+static unsigned int noverflow = 0;
+static int epfd = -1;
+static int resolver_pipe[2] = {-1, -1};
+static SSL_CTX *ssl_ctx = NULL;
+static ulong seq_counter = 0;
+
+ulong OSHttpClient::nsubmitted = 0;
+ulong OSHttpClient::nfailed = 0;
+
+static bool http_engine_init() {
+	if(epfd>=0) return true;
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(epfd<0) return false;
+	if(pipe2(resolver_pipe, O_NONBLOCK|O_CLOEXEC)<0) {
+		close(epfd);
+		epfd = -1;
+		return false;
+	}
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u64 = HTTP_EV_RESOLVER;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, resolver_pipe[0], &ev);
+	for(unsigned char i=0;i<HTTP_ASYNC_MAX_REQUESTS;i++) slots[i].fd = -1;
+	return true;
+}
+
+static void *resolver_thread(void *arg) {
+	HTTPResolveJob *job = (HTTPResolveJob *)arg;
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	job->err = getaddrinfo(job->host, job->port, &hints, &job->res);
+	// hand the job back to the main loop; the pipe write of a pointer is atomic
+	if(write(resolver_pipe[1], &job, sizeof(job))!=sizeof(job)) {
+		if(job->res) freeaddrinfo(job->res);
+		delete job;
+	}
+	return NULL;
+}
+
+/** Queue a request
+ * Returns HTTP_RQT_SUCCESS if the request is accepted; the result is then
+ * delivered through the callbacks from a later loop() call.
+ */
+int8_t OSHttpClient::submit(const HTTPRequest &rqt) {
+	if(rqt.server==NULL || rqt.server[0]==0 || rqt.port==0 || rqt.payload==NULL) {
+		DEBUG_PRINTLN("server:port is invalid!");
+		return HTTP_RQT_CONNECT_ERR;
+	}
+	if(strlen(rqt.server)>=HTTP_ASYNC_HOST_SIZE) return HTTP_RQT_CONNECT_ERR;
+	if(!http_engine_init()) return HTTP_RQT_CONNECT_ERR;
+
+	HTTPSlot s;
+	memset(&s, 0, sizeof(s));
+	strcpy(s.host, rqt.server);
+	s.port = rqt.port;
+	s.usessl = rqt.usessl;
+	s.timeout = rqt.timeout;
+	s.callback = rqt.callback;
+	s.done = rqt.done;
+	// the whole payload is sent, however long
+	s.reqlen = strlen(rqt.payload);
+	s.req = new char[s.reqlen];
+	memcpy(s.req, rqt.payload, s.reqlen);
+	s.fd = -1;
+	s.seq = ++seq_counter;
+	s.state = HTTP_SLOT_WAITING;
+	nsubmitted++;
+
+	unsigned char i;
+	for(i=0;i<HTTP_ASYNC_MAX_REQUESTS;i++) {
+		if(slots[i].state==HTTP_SLOT_FREE) break;
+	}
+	if(i<HTTP_ASYNC_MAX_REQUESTS && !overflow_head) {
+		s.gen = slots[i].gen;
+		slots[i] = s;
+	} else {
+		// all slots are taken: keep the request in order until one is released
+		HTTPQueued *q = new HTTPQueued;
+		q->slot = s;
+		q->next = NULL;
+		if(overflow_tail) overflow_tail->next = q;
+		else overflow_head = q;
+		overflow_tail = q;
+		noverflow++;
+	}
+
+	start_waiting();
+	return HTTP_RQT_SUCCESS;
+}
+
+/** Move overflow requests into free slots, oldest first */
+static void http_take_overflow() {
+	for(unsigned char i=0;i<HTTP_ASYNC_MAX_REQUESTS && overflow_head;i++) {
+		if(slots[i].state!=HTTP_SLOT_FREE) continue;
+		HTTPQueued *q = overflow_head;
+		overflow_head = q->next;
+		if(!overflow_head) overflow_tail = NULL;
+		noverflow--;
+		q->slot.gen = slots[i].gen;
+		slots[i] = q->slot;
+		delete q;
+	}
+}
+
+/** Start waiting requests that have no earlier request to the same server in flight */
+void OSHttpClient::start_waiting() {
+	http_take_overflow();
+	for(unsigned char i=0;i<HTTP_ASYNC_MAX_REQUESTS;i++) {
+		if(slots[i].state!=HTTP_SLOT_WAITING) continue;
+		bool blocked = false;
+		for(unsigned char j=0;j<HTTP_ASYNC_MAX_REQUESTS;j++) {
+			if(j==i || slots[j].state==HTTP_SLOT_FREE) continue;
+			if(slots[j].seq<slots[i].seq && slots[j].port==slots[i].port && strcmp(slots[j].host, slots[i].host)==0) {
+				blocked = true;
+				break;
+			}
+		}
+		if(!blocked) start(i);
+	}
+}
+
+void OSHttpClient::start(unsigned char i) {
+	HTTPSlot &s = slots[i];
+	s.deadline = millis() + s.timeout;
+	DEBUG_PRINT(s.host);
+	DEBUG_PRINT(":");
+	DEBUG_PRINTLN(s.port);
+
+	// dotted IP addresses do not need the resolver
+	struct sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	if(inet_pton(AF_INET, s.host, &sin.sin_addr)==1) {
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons(s.port);
+		connect_addr(i, (struct sockaddr *)&sin, sizeof(sin));
+		return;
+	}
+
+	HTTPResolveJob *job = new HTTPResolveJob;
+	job->idx = i;
+	job->gen = s.gen;
+	strcpy(job->host, s.host);
+	snprintf(job->port, sizeof(job->port), "%u", s.port);
+	job->err = 0;
+	job->res = NULL;
+	s.state = HTTP_SLOT_RESOLVING;
+
+	pthread_t tid;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if(pthread_create(&tid, &attr, resolver_thread, job)!=0) {
+		delete job;
+		finish(i, HTTP_RQT_CONNECT_ERR);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+void OSHttpClient::on_resolved() {
+	HTTPResolveJob *job;
+	while(read(resolver_pipe[0], &job, sizeof(job))==sizeof(job)) {
+		unsigned char i = job->idx;
+		// the request may have timed out and the slot been reused in the meantime
+		if(slots[i].gen==job->gen && slots[i].state==HTTP_SLOT_RESOLVING) {
+			if(job->err || !job->res) {
+				DEBUG_PRINTLN(F("http: host lookup failed"));
+				finish(i, HTTP_RQT_CONNECT_ERR);
+			} else {
+				connect_addr(i, job->res->ai_addr, job->res->ai_addrlen);
+			}
+		}
+		if(job->res) freeaddrinfo(job->res);
+		delete job;
+	}
+}
+
+void OSHttpClient::watch(unsigned char i, uint32_t events) {
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.u64 = ((uint64_t)slots[i].gen<<8) | i;
+	if(epoll_ctl(epfd, EPOLL_CTL_MOD, slots[i].fd, &ev)<0) {
+		epoll_ctl(epfd, EPOLL_CTL_ADD, slots[i].fd, &ev);
+	}
+}
+
+void OSHttpClient::connect_addr(unsigned char i, const struct sockaddr *addr, int addrlen) {
+	HTTPSlot &s = slots[i];
+	s.fd = socket(addr->sa_family, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if(s.fd<0) {
+		finish(i, HTTP_RQT_CONNECT_ERR);
+		return;
+	}
+	s.state = HTTP_SLOT_CONNECTING;
+	if(connect(s.fd, addr, addrlen)==0) {
+		on_connected(i);
+	} else if(errno==EINPROGRESS) {
+		watch(i, EPOLLOUT);
+	} else {
+		DEBUG_PRINTLN(F("failed."));
+		finish(i, HTTP_RQT_CONNECT_ERR);
+	}
+}
+
+void OSHttpClient::on_connected(unsigned char i) {
+	HTTPSlot &s = slots[i];
+	int err = 0;
+	socklen_t len = sizeof(err);
+	if(getsockopt(s.fd, SOL_SOCKET, SO_ERROR, &err, &len)<0 || err) {
+		DEBUG_PRINTLN(F("failed."));
+		finish(i, HTTP_RQT_CONNECT_ERR);
+		return;
+	}
+	if(s.usessl) {
+		if(!ssl_ctx) {
+			ssl_ctx = SSL_CTX_new(TLS_client_method());
+			if(ssl_ctx) SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
+		}
+		s.ssl = ssl_ctx ? SSL_new(ssl_ctx) : NULL;
+		if(!s.ssl) {
+			finish(i, HTTP_RQT_CONNECT_ERR);
+			return;
+		}
+		SSL_set_fd(s.ssl, s.fd);
+		SSL_set_tlsext_host_name(s.ssl, s.host);
+		SSL_set_connect_state(s.ssl);
+		s.state = HTTP_SLOT_HANDSHAKE;
+		do_handshake(i);
+	} else {
+		s.state = HTTP_SLOT_SENDING;
+		do_send(i);
+	}
+}
+
+void OSHttpClient::do_handshake(unsigned char i) {
+	HTTPSlot &s = slots[i];
+	int ret = SSL_do_handshake(s.ssl);
+	if(ret==1) {
+		s.state = HTTP_SLOT_SENDING;
+		do_send(i);
+		return;
+	}
+	int err = SSL_get_error(s.ssl, ret);
+	if(err==SSL_ERROR_WANT_READ) watch(i, EPOLLIN);
+	else if(err==SSL_ERROR_WANT_WRITE) watch(i, EPOLLOUT);
+	else {
+		DEBUG_PRINTLN(F("http: TLS handshake failed"));
+		finish(i, HTTP_RQT_CONNECT_ERR);
+	}
+}
+
+void OSHttpClient::do_send(unsigned char i) {
+	HTTPSlot &s = slots[i];
+	while(s.sent<s.reqlen) {
+		int n;
+		if(s.ssl) {
+			n = SSL_write(s.ssl, s.req+s.sent, s.reqlen-s.sent);
+			if(n<=0) {
+				int err = SSL_get_error(s.ssl, n);
+				if(err==SSL_ERROR_WANT_WRITE) { watch(i, EPOLLOUT); return; }
+				if(err==SSL_ERROR_WANT_READ) { watch(i, EPOLLIN); return; }
+				finish(i, HTTP_RQT_CONNECT_ERR);
+				return;
+			}
+		} else {
+			n = send(s.fd, s.req+s.sent, s.reqlen-s.sent, MSG_NOSIGNAL);
+			if(n<0) {
+				if(errno==EAGAIN || errno==EWOULDBLOCK) { watch(i, EPOLLOUT); return; }
+				finish(i, HTTP_RQT_CONNECT_ERR);
+				return;
+			}
+		}
+		s.sent += n;
+	}
+	s.resp = new char[ETHER_BUFFER_SIZE+1];
+	s.resplen = 0;
+	s.state = HTTP_SLOT_RECEIVING;
+	watch(i, EPOLLIN);
+	do_recv(i);
+}
+
+void OSHttpClient::do_recv(unsigned char i) {
+	HTTPSlot &s = slots[i];
+	while(s.resplen<ETHER_BUFFER_SIZE) {
+		int n;
+		if(s.ssl) {
+			n = SSL_read(s.ssl, s.resp+s.resplen, ETHER_BUFFER_SIZE-s.resplen);
+			if(n<=0) {
+				int err = SSL_get_error(s.ssl, n);
+				if(err==SSL_ERROR_WANT_READ) return;
+				if(err==SSL_ERROR_WANT_WRITE) { watch(i, EPOLLOUT); return; }
+				break; // closed by server (or error): work with data received so far
+			}
+		} else {
+			n = recv(s.fd, s.resp+s.resplen, ETHER_BUFFER_SIZE-s.resplen, 0);
+			if(n<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) return;
+			if(n<=0) break;
+		}
+		s.resplen += n;
+	}
+	finish(i, HTTP_RQT_SUCCESS);
+}
+
+/** Release a slot and report the result */
+void OSHttpClient::finish(unsigned char i, int8_t result) {
+	HTTPSlot &s = slots[i];
+	if(s.ssl) {
+		SSL_free(s.ssl);
+		s.ssl = NULL;
+	}
+	if(s.fd>=0) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, s.fd, NULL);
+		close(s.fd);
+		s.fd = -1;
+	}
+	delete[] s.req;
+	s.req = NULL;
+	char *resp = s.resp;
+	uint16_t resplen = s.resplen;
+	void (*callback)(char *) = s.callback;
+	void (*done)(int8_t) = s.done;
+	s.resp = NULL;
+	s.state = HTTP_SLOT_FREE;
+	s.gen++;
+
+	if(result==HTTP_RQT_SUCCESS && (!resp || resplen==0)) result = HTTP_RQT_EMPTY_RETURN;
+	if(result!=HTTP_RQT_SUCCESS) nfailed++;
+	// the callbacks may submit new requests, so the slot must be released first
+	if(result==HTTP_RQT_SUCCESS) {
+		resp[resplen] = 0; // properly end buffer with 0
+		if(callback) callback(resp);
+	}
+	if(done) done(result);
+	delete[] resp;
+
+	start_waiting();
+}
+
+/** Progress all requests; never blocks */
+void OSHttpClient::loop() {
+	if(epfd<0) return;
+	struct epoll_event events[HTTP_ASYNC_MAX_REQUESTS+1];
+	int n = epoll_wait(epfd, events, HTTP_ASYNC_MAX_REQUESTS+1, 0);
+	for(int k=0;k<n;k++) {
+		uint64_t tag = events[k].data.u64;
+		if(tag==HTTP_EV_RESOLVER) {
+			on_resolved();
+			continue;
+		}
+		unsigned char i = tag&0xFF;
+		// skip events of a request that has finished earlier in this batch
+		if(i>=HTTP_ASYNC_MAX_REQUESTS || slots[i].gen!=(uint32_t)(tag>>8)) continue;
+		switch(slots[i].state) {
+			case HTTP_SLOT_CONNECTING: on_connected(i); break;
+			case HTTP_SLOT_HANDSHAKE:  do_handshake(i); break;
+			case HTTP_SLOT_SENDING:    do_send(i);      break;
+			case HTTP_SLOT_RECEIVING:  do_recv(i);      break;
+		}
+	}
+
+	// check time outs
+	ulong curr = millis();
+	for(unsigned char i=0;i<HTTP_ASYNC_MAX_REQUESTS;i++) {
+		HTTPSlot &s = slots[i];
+		if(s.state<=HTTP_SLOT_WAITING || (long)(curr-s.deadline)<0) continue;
+		DEBUG_PRINTLN(F("host timeout occured"));
+		// as on the other platforms, work with data received so far
+		finish(i, (s.state==HTTP_SLOT_RECEIVING && s.resplen) ? HTTP_RQT_SUCCESS : HTTP_RQT_TIMEOUT);
+	}
+}
+
+/** Number of requests in flight or waiting */
+unsigned int OSHttpClient::pending() {
+	unsigned int n = noverflow;
+	for(unsigned char i=0;i<HTTP_ASYNC_MAX_REQUESTS;i++) {
+		if(slots[i].state!=HTTP_SLOT_FREE) n++;
+	}
+	return n;
+}
+
+int OSHttpClient::get_fd() {
+	http_engine_init();
+	return epfd;
+}
+
+#endif
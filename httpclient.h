@@ -0,0 +1,76 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Asynchronous HTTP client header file
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HTTPCLIENT_H
+#define _HTTPCLIENT_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include "defines.h"
+
+#define HTTP_ASYNC_MAX_REQUESTS  8   // maximum number of requests in flight; more wait in an overflow list
+#define HTTP_ASYNC_HOST_SIZE     64  // maximum host name length
+
+struct sockaddr;
+
+/** Outbound HTTP request descriptor */
+struct HTTPRequest {
+	const char *server;   // host name or dotted IP address
+	uint16_t port;
+	const char *payload;  // complete request text, copied on submit
+	bool usessl;
+	uint16_t timeout;     // in milliseconds, covering the whole request
+	void (*callback)(char *response); // called with the response if any data was received
+	void (*done)(int8_t result);      // optional: called with the HTTP_RQT_* result when the request finishes
+};
+
+/** Event-driven HTTP(S) client
+ * Requests are submitted with a completion callback and progressed by
+ * loop(), which is called from do_loop and never blocks. Requests to the
+ * same server and port are carried out in the order they were submitted.
+ */
+class OSHttpClient {
+public:
+	static int8_t submit(const HTTPRequest &rqt);
+	static void loop();
+	static unsigned int pending();
+	static int get_fd();  // epoll descriptor that becomes readable when loop() has work to do
+
+	static ulong nsubmitted; // number of requests accepted
+	static ulong nfailed;    // number of requests that ended with an error or timeout
+private:
+	static void start_waiting();
+	static void start(unsigned char i);
+	static void connect_addr(unsigned char i, const struct sockaddr *addr, int addrlen);
+	static void on_connected(unsigned char i);
+	static void do_handshake(unsigned char i);
+	static void do_send(unsigned char i);
+	static void do_recv(unsigned char i);
+	static void on_resolved();
+	static void watch(unsigned char i, uint32_t events);
+	static void finish(unsigned char i, int8_t result);
+};
+
+#endif
+
+#endif // _HTTPCLIENT_H
@@ -30,6 +30,14 @@
 #include "opensprinkler_server.h"
 #include "mqtt.h"
 #include "main.h"
+#include "httpclient.h"
+#include "telemetry.h"
+#include "binlog.h"
+#include "rollup.h"
+#include "reactor.h"
+#include "sim.h"
+#include "bench.h"
+#include "test.h"
 
 #if defined(ARDUINO)
 #include <Arduino.h>
@@ -54,7 +62,7 @@
 	#endif
 	unsigned long getNtpTime();
 #else // header and defs for RPI/BBB
-
+	#include <atomic>
 #endif
 
 #if defined(USE_OTF)
@@ -97,6 +105,19 @@ float flow_last_gpm=0;
 
 uint32_t reboot_timer = 0;
 
+/** Count one flow sensor pulse that arrived at time curr (ms) */
+static void flow_pulse(ulong curr) {
+	flow_count++;
+
+	/* RAH implementation of flow sensor */
+	if (flow_start==0) { flow_gallons=0; flow_start=curr;} // if first pulse, record time
+	if ((curr-flow_start)<90000) { flow_gallons=0; } // wait 90 seconds before recording flow_begin
+	else {	if (flow_gallons==1)	{  flow_begin = curr;}}
+	flow_stop = curr; // get time in ms for stop
+	flow_gallons++;  // increment gallon count for each poll
+	/* End of RAH implementation of flow sensor */
+}
+
 void flow_poll() {
 	#if defined(ESP8266)
 	if(os.hw_rev>=2) pinModeExt(PIN_SENSOR1, INPUT_PULLUP); // this seems necessary for OS 3.2
@@ -107,17 +128,44 @@ void flow_poll() {
 		return;
 	}
 	prev_flow_state = curr_flow_state;
-	ulong curr = millis();
-	flow_count++;
+	flow_pulse(millis());
+}
 
-	/* RAH implementation of flow sensor */
-	if (flow_start==0) { flow_gallons=0; flow_start=curr;} // if first pulse, record time
-	if ((curr-flow_start)<90000) { flow_gallons=0; } // wait 90 seconds before recording flow_begin
-	else {	if (flow_gallons==1)	{  flow_begin = curr;}}
-	flow_stop = curr; // get time in ms for stop
-	flow_gallons++;  // increment gallon count for each poll
-	/* End of RAH implementation of flow sensor */
+#if !defined(ARDUINO)
+/** Flow pulses caught on the falling edge by the GPIO interrupt thread
+ * The interrupt thread only advances flow_ring_head and do_loop only
+ * advances flow_ring_tail, so the ring needs no lock. Pulses that find
+ * the ring full are still counted, but without a time stamp.
+ */
+#define FLOW_RING_SIZE 256
+static ulong flow_ring[FLOW_RING_SIZE];
+static std::atomic<uint32_t> flow_ring_head(0), flow_ring_tail(0);
+static std::atomic<uint32_t> flow_ring_overrun(0);
+static bool flow_irq = false;        // pulses arrive through the ring
+static bool flow_irq_tried = false;
+
+static void flow_isr() {
+	uint32_t head = flow_ring_head.load(std::memory_order_relaxed);
+	if(head - flow_ring_tail.load(std::memory_order_acquire) >= FLOW_RING_SIZE) {
+		flow_ring_overrun.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	flow_ring[head % FLOW_RING_SIZE] = millis();
+	flow_ring_head.store(head+1, std::memory_order_release);
+}
+
+/** Count the pulses collected by flow_isr since the last call */
+static void flow_drain() {
+	uint32_t tail = flow_ring_tail.load(std::memory_order_relaxed);
+	uint32_t head = flow_ring_head.load(std::memory_order_acquire);
+	while(tail != head) {
+		flow_pulse(flow_ring[tail % FLOW_RING_SIZE]);
+		tail++;
+	}
+	flow_ring_tail.store(tail, std::memory_order_release);
+	flow_count += flow_ring_overrun.exchange(0, std::memory_order_relaxed);
 }
+#endif
 
 #if defined(ARDUINO)
 // ====== UI defines ======
@@ -385,6 +433,10 @@ void do_setup() {
 
 	pd.init();           // ProgramData init
 
+#if defined(SIMULATION)
+	// the simulated controller has no network
+	os.status.network_fails = 0;
+#else
 	if (os.start_network()) {  // initialize network
 		DEBUG_PRINTLN("network established.");
 		os.status.network_fails = 0;
@@ -392,6 +444,7 @@ void do_setup() {
 		DEBUG_PRINTLN("network failed.");
 		os.status.network_fails = 1;
 	}
+#endif
 	os.status.req_network = 0;
 
 	// because at reboot we don't know if special stations
@@ -400,10 +453,13 @@ void do_setup() {
 		os.switch_special_station(sid, 0);
 	}
 
+#if !defined(SIMULATION)
 	os.mqtt.init();
 	os.status.req_mqtt_restart = true;
+	OSTelemetry::init();
 
 	initalize_otf();
+#endif
 }
 #endif
 
@@ -412,6 +468,12 @@ static void check_network();
 void check_weather();
 static bool process_special_program_command(const char*, uint32_t curr_time);
 static void perform_ntp_sync();
+static unsigned char master_state(unsigned char mas, time_os_t curr_time, time_os_t *until);
+
+// state of each master, valid from master_from until master_until (0: no change ahead)
+static unsigned char master_on[NUM_MASTER_ZONES];
+static time_os_t master_from[NUM_MASTER_ZONES];
+static time_os_t master_until[NUM_MASTER_ZONES];
 
 #if defined(ESP8266)
 bool delete_log_oldest();
@@ -435,17 +497,28 @@ void do_loop()
 	// handle flow sensor using polling every 1ms (maximum freq 1/(2*1ms)=500Hz)
 	static ulong flowpoll_timeout=0;
 	if(os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) {
+#if !defined(ARDUINO)
+		// where the pin has edge events, pulses are counted by the interrupt thread instead
+		if(!flow_irq_tried) {
+			flow_irq_tried = true;
+			flow_irq = attachInterrupt(PIN_SENSOR1, "falling", flow_isr);
+		}
+		if(flow_irq) flow_drain();
+		else
+#endif
+		{
 		ulong curr = millis();
 		if(curr!=flowpoll_timeout) {
 			flowpoll_timeout = curr;
 			flow_poll();
 		}
+		}
 	}
 
 	static time_os_t last_time = 0;
 	static ulong last_minute = 0;
 
-	unsigned char bid, sid, s, pid, qid, gid, bitvalue;
+	unsigned char bid, sid, s, pid, qid, bitvalue;
 	ProgramStruct prog;
 
 	os.status.mas = os.iopts[IOPT_MASTER_STATION];
@@ -588,10 +661,14 @@ void do_loop()
 
 	ui_state_machine();
 
-#else // Process Ethernet packets for RPI/BBB
+#elif !defined(SIMULATION) // Process Ethernet packets for RPI/BBB
 	if(otf) otf->loop();
+	OSHttpClient::loop(); // progress outbound http requests
+	OSTelemetry::loop(curr_time); // write out buffered valve events
+	OSBinLog::loop(curr_time); // write out log records that have waited long enough
 #endif	// Process Ethernet packets
 
+#if !defined(SIMULATION)
 	// Start up MQTT when we have a network connection
 	if (os.status.req_mqtt_restart && os.network_connected()) {
 		DEBUG_PRINTLN(F("req_mqtt_restart"));
@@ -600,6 +677,7 @@ void do_loop()
 		os.mqtt.subscribe();
 	}
 	os.mqtt.loop();
+#endif
 
 	// The main control loop runs once every second
 	if (curr_time != last_time) {
@@ -687,7 +765,6 @@ void do_loop()
 		// ====== Schedule program data ======
 		ulong curr_minute = curr_time / 60;
 		boolean match_found = false;
-		RuntimeQueueStruct *q;
 		// since the granularity of start time is minute
 		// we only need to check once every minute
 		if (curr_minute != last_minute) {
@@ -696,7 +773,15 @@ void do_loop()
 			apply_monthly_adjustment(curr_time); // check and apply monthly adjustment here, if it's selected
 
 			// check through all programs
+#if defined(ARDUINO)
 			for(pid=0; pid<pd.nprograms; pid++) {
+#else
+			// only visit programs the start time index reports as due
+			unsigned char due_pids[MAX_NUM_PROGRAMS];
+			unsigned char ndue = pd.start_index_pop(curr_time, due_pids);
+			for(unsigned char di=0; di<ndue; di++) {
+				pid = due_pids[di];
+#endif
 				pd.read(pid, &prog);	// todo future: reduce load time
 				if(prog.check_match(curr_time)) {
 					// program match found
@@ -727,12 +812,7 @@ void do_loop()
 							if (water_time) {
 								// check if water time is still valid
 								// because it may end up being zero after scaling
-								q = pd.enqueue();
-								if (q) {
-									q->st = 0;
-									q->dur = water_time;
-									q->sid = sid;
-									q->pid = pid+1;
+								if (pd.enqueue(water_time, sid, pid+1) != 0xFF) {
 									match_found = true;
 								} else {
 									// queue is full
@@ -752,13 +832,13 @@ void do_loop()
 
 				// For debugging: print out queued elements
 				/*DEBUG_PRINT("en:");
-				for(q=pd.queue;q<pd.queue+pd.nqueue;q++) {
+				for(qid=0;qid<pd.nqueue;qid++) {
 					DEBUG_PRINT("[");
-					DEBUG_PRINT(q->sid);
+					DEBUG_PRINT(pd.queue.sid[qid]);
 					DEBUG_PRINT(",");
-					DEBUG_PRINT(q->dur);
+					DEBUG_PRINT(pd.queue.dur[qid]);
 					DEBUG_PRINT(",");
-					DEBUG_PRINT(q->st);
+					DEBUG_PRINT(pd.queue.st[qid]);
 					DEBUG_PRINT("]");
 				}
 				DEBUG_PRINTLN("");*/
@@ -770,16 +850,14 @@ void do_loop()
 		// If so, do station run-time keeping
 		if (os.status.program_busy){
 			// first, go through run time queue to assign queue elements to stations
-			q = pd.queue;
-			qid=0;
-			for(;q<pd.queue+pd.nqueue;q++,qid++) {
-				sid=q->sid;
+			for(qid=0;qid<pd.nqueue;qid++) {
+				sid=pd.queue.sid[qid];
 				unsigned char sqi=pd.station_qid[sid];
 				// skip if station is already assigned a queue element
 				// and that queue element has an earlier start time
-				if(sqi<255 && pd.queue[sqi].st<q->st) continue;
+				if(sqi<255 && pd.queue.st[sqi]<pd.queue.st[qid]) continue;
 				// otherwise assign the queue element to station
-				pd.station_qid[sid]=qid;
+				pd.set_station_qid(sid, qid);
 			}
 			// next, go through the stations and perform time keeping
 			for(bid=0;bid<os.nboards; bid++) {
@@ -792,18 +870,20 @@ void do_loop()
 					if (os.status.mas2== sid+1) continue;
 					if (pd.station_qid[sid]==255) continue;
 
-					q = pd.queue + pd.station_qid[sid];
+					qid = pd.station_qid[sid];
+					time_os_t st = pd.queue.st[qid];
+					time_os_t et = pd.queue.end_time(qid);
 
 					// if current station is not running, check if we should turn it on
 					if(!((bitvalue >> s) & 1)) {
-						if (curr_time >= q->st && curr_time < q->st+q->dur) {
-							turn_on_station(sid, q->st+q->dur-curr_time); // the last parameter is expected run time
+						if (curr_time >= st && curr_time < et) {
+							turn_on_station(sid, et-curr_time); // the last parameter is expected run time
 						} //if curr_time > scheduled_start_time
 					} // if current station is not running
 
 					// check if this station should be turned off
-					if (q->st > 0) {
-						if (curr_time >= q->st+q->dur) {
+					if (st > 0) {
+						if (curr_time >= et) {
 							turn_off_station(sid, curr_time);
 						}
 					}
@@ -811,12 +891,15 @@ void do_loop()
 			}//end_bid
 
 			// finally, go through the queue again and clear up elements marked for removal
-			int qi;
-			for(qi=pd.nqueue-1;qi>=0;qi--) {
-				q=pd.queue+qi;
-				if(!q->dur || curr_time >= q->deque_time) {
-					pd.dequeue(qi);
-				}
+			// (flags are computed first in a branch-free pass; dequeue only moves
+			// the last element, which has already been checked, into the gap)
+			unsigned char done[RUNTIME_QUEUE_SIZE];
+			int qi, nq = pd.nqueue;
+			for(qi=0;qi<nq;qi++) {
+				done[qi] = (pd.queue.dur[qi]==0) | (curr_time >= pd.queue.deque_time[qi]);
+			}
+			for(qi=nq-1;qi>=0;qi--) {
+				if(done[qi]) pd.dequeue(qi);
 			}
 
 			// process dynamic events
@@ -826,25 +909,7 @@ void do_loop()
 			os.apply_all_station_bits();
 
 			// check through runtime queue, calculate the last stop time of sequential stations
-			memset(pd.last_seq_stop_times, 0, sizeof(ulong)*NUM_SEQ_GROUPS);
-			time_os_t sst;
-			unsigned char re=os.iopts[IOPT_REMOTE_EXT_MODE];
-			q = pd.queue;
-			for(;q<pd.queue+pd.nqueue;q++) {
-				sid = q->sid;
-				bid = sid>>3;
-				s = sid&0x07;
-				gid = os.get_station_gid(sid);
-				// check if any sequential station has a valid stop time
-				// and the stop time must be larger than curr_time
-				sst = q->st + q->dur;
-				if (sst>curr_time) {
-					// only need to update last_seq_stop_time for sequential stations
-					if (os.is_sequential_station(sid) && !re) {
-						pd.last_seq_stop_times[gid] = (sst > pd.last_seq_stop_times[gid]) ? sst : pd.last_seq_stop_times[gid];
-					}
-				}
-			}
+			update_last_seq_stop_times(curr_time);
 
 			// if the runtime queue is empty
 			// reset all stations
@@ -874,28 +939,14 @@ void do_loop()
 			unsigned char mas_id = os.masters[mas][MASOPT_SID];
 
 			if (mas_id) { // if this master station is set
-				int16_t mas_on_adj = os.get_on_adj(mas);
-				int16_t mas_off_adj = os.get_off_adj(mas);
-
-				unsigned char masbit = 0;
-
-				for(sid = 0; sid < os.nstations; sid++) {
-					// skip if this is the master station
-					if (mas_id == sid + 1) continue;
-
-					if(pd.station_qid[sid]==255) continue; // skip if station is not in the queue
-
-					q = pd.queue + pd.station_qid[sid];
-
-					if (os.bound_to_master(q->sid, mas)) {
-						// check if timing is within the acceptable range
-						if (curr_time >= q->st + mas_on_adj &&
-							curr_time <= q->st + q->dur + mas_off_adj) {
-							masbit = 1;
-							break;
-						}
-					}
+				// the state is only recomputed when the queue or the master settings
+				// have changed, or when the current time leaves its validity interval
+				if (pd.master_dirty || curr_time < master_from[mas] ||
+					(master_until[mas] && curr_time >= master_until[mas])) {
+					master_on[mas] = master_state(mas, curr_time, &master_until[mas]);
+					master_from[mas] = curr_time;
 				}
+				unsigned char masbit = master_on[mas];
 		
 				if(os.get_station_bit(mas_id - 1) == 0 && masbit == 1){ // notify master on event
 					push_message(NOTIFY_STATION_ON, mas_id - 1, 0);
@@ -905,6 +956,8 @@ void do_loop()
 			}
 		}
 
+		pd.master_dirty = false;
+
 		if (os.status.pause_state) {
 			if (os.pause_timer > 0) {
 				os.pause_timer--;
@@ -932,6 +985,7 @@ void do_loop()
 			if (!os.status.program_busy) {
 				// and if no program is scheduled to run in the next minute
 				bool willrun = false;
+#if defined(ARDUINO)
 				for(pid=0; pid<pd.nprograms; pid++) {
 					pd.read(pid, &prog);
 					if(prog.check_match(curr_time+60)) {
@@ -939,6 +993,10 @@ void do_loop()
 						break;
 					}
 				}
+#else
+				time_os_t next_t = pd.start_index_peek(curr_time);
+				if(next_t && next_t<=curr_time+60) willrun = true;
+#endif
 				if (!willrun) {
 					os.reboot_dev(os.nvdata.reboot_cause);
 				}
@@ -961,6 +1019,7 @@ void do_loop()
 		// we use Arduino's millis() method
 		if (curr_time % NTP_SYNC_INTERVAL == 0) os.status.req_ntpsync = 1;
 		//if((millis()/1000) % NTP_SYNC_INTERVAL==15) os.status.req_ntpsync = 1;
+#if !defined(SIMULATION) // the scenario supplies time and weather
 		perform_ntp_sync();
 
 		// check network connection
@@ -969,6 +1028,7 @@ void do_loop()
 
 		// check weather
 		check_weather();
+#endif
 
 		if(os.weather_update_flag & WEATHER_UPDATE_WL) {
 			// at the moment, we only send notification if water level changed
@@ -987,10 +1047,6 @@ void do_loop()
 			}
 		}
 	}
-
-	#if !defined(ARDUINO)
-		delay(1); // For OSPI/OSBO/LINUX, sleep 1 ms to minimize CPU usage
-	#endif
 }
 
 /** Check and process special program command */
@@ -1061,30 +1117,56 @@ void turn_on_station(unsigned char sid, ulong duration) {
 	}
 }
 
-// after removing element q, update remaining stations in its group
-void handle_shift_remaining_stations(RuntimeQueueStruct* q, unsigned char gid, time_os_t curr_time) {
-	RuntimeQueueStruct *s = pd.queue;
-	time_os_t q_end_time = q->st + q->dur;
+/** Calculate the last stop time of the sequential stations of each group */
+void update_last_seq_stop_times(time_os_t curr_time) {
+	memset(pd.last_seq_stop_times, 0, sizeof(ulong)*NUM_SEQ_GROUPS);
+	time_os_t sst;
+	unsigned char re=os.iopts[IOPT_REMOTE_EXT_MODE];
+	// only need to update last_seq_stop_time for sequential stations
+	if (re) return;
+	for(unsigned char gid=0;gid<NUM_SEQ_GROUPS;gid++) {
+		for(unsigned char qid=pd.queue.head[gid];qid!=QUEUE_NONE;qid=pd.queue.next[qid]) {
+			// check if any sequential station has a valid stop time
+			// and the stop time must be larger than curr_time
+			sst = pd.queue.end_time(qid);
+			if (sst>curr_time && sst>pd.last_seq_stop_times[gid]) {
+				pd.last_seq_stop_times[gid] = sst;
+			}
+		}
+	}
+}
+
+// after removing element qid, update remaining stations in its group
+void handle_shift_remaining_stations(unsigned char qid, unsigned char gid, time_os_t curr_time) {
+	time_os_t q_end_time = pd.queue.end_time(qid);
 	ulong remainder = 0;
 
 	if (q_end_time > curr_time) { // remainder is non-zero
-		remainder = (q->st < curr_time) ? q_end_time - curr_time : q->dur;
-		for ( ; s < pd.queue + pd.nqueue; s++) {
-
-			// ignore station to be removed and stations in other groups
-			if (s == q || os.get_station_gid(s->sid) != gid || !os.is_sequential_station(s->sid)) {
-				continue;
-			}
+		remainder = (pd.queue.st[qid] < curr_time) ? q_end_time - curr_time : pd.queue.dur[qid];
+		// the group list is ordered by start time, so the stations
+		// following the current station are all behind it on the list
+		unsigned char i, ni;
+		i = (pd.queue.list[qid] == gid) ? pd.queue.next[qid] : QUEUE_NONE;
+		for ( ; i != QUEUE_NONE; i = ni) {
+			ni = pd.queue.next[i];
 
 			// only shift stations following current station
-			if (s->st >= q_end_time) {
-				s->st -= remainder;
-				s->deque_time -= remainder;
+			if (pd.queue.st[i] < q_end_time) continue;
+
+			pd.queue.st[i] -= remainder;
+			pd.queue.deque_time[i] -= remainder;
+			// with a negative station delay, a shifted station can now start before
+			// an unshifted one that overlapped the current station: re-insert it
+			unsigned char p = pd.queue.prev[i];
+			if (p != QUEUE_NONE && pd.queue.st[p] > pd.queue.st[i]) {
+				pd.queue.unlink(i);
+				pd.queue.link_sorted(i, gid);
 			}
 		}
 	}
 	pd.last_seq_stop_times[gid] -= remainder;
 	pd.last_seq_stop_times[gid] += 1;
+	pd.master_dirty = true;
 }
 
 /** Turn off a station
@@ -1099,24 +1181,23 @@ void turn_off_station(unsigned char sid, time_os_t curr_time, unsigned char shif
 	if (qid >= pd.nqueue)  {
 		return;
 	}
-	RuntimeQueueStruct *q = pd.queue + qid;
 	unsigned char force_dequeue = 0;
 	unsigned char station_bit = os.is_running(sid);
-	unsigned char gid = os.get_station_gid(q->sid);
+	unsigned char gid = os.get_station_gid(pd.queue.sid[qid]);
 
 	if (shift && os.is_sequential_station(sid) && !os.iopts[IOPT_REMOTE_EXT_MODE]) {
-		handle_shift_remaining_stations(q, gid, curr_time);
+		handle_shift_remaining_stations(qid, gid, curr_time);
 	}
 
-	if (curr_time >= q->deque_time) {
+	if (curr_time >= pd.queue.deque_time[qid]) {
 		if (station_bit) {
 			force_dequeue = 1;
 		} else { // if already off just remove from the queue
 			pd.dequeue(qid);
-			pd.station_qid[sid] = 0xFF;
+			pd.set_station_qid(sid, 0xFF);
 			return;
 		}
-	} else if (curr_time >= q->st + q->dur) { // end time and dequeue time are not equal due to master handling
+	} else if (curr_time >= pd.queue.end_time(qid)) { // end time and dequeue time are not equal due to master handling
 		if (!station_bit) { return; }
 	} //else { return; }
 
@@ -1131,29 +1212,45 @@ void turn_off_station(unsigned char sid, time_os_t curr_time, unsigned char shif
 
 	// check if the current time is past the scheduled start time,
 	// because we may be turning off a station that hasn't started yet
-	if (curr_time >= q->st) {
+	if (curr_time >= pd.queue.st[qid]) {
 		// record lastrun log (only for non-master stations)
 		if (os.status.mas != (sid + 1) && os.status.mas2 != (sid + 1)) {
 			pd.lastrun.station = sid;
-			pd.lastrun.program = q->pid;
-			pd.lastrun.duration = curr_time - q->st;
+			pd.lastrun.program = pd.queue.pid[qid];
+			pd.lastrun.duration = curr_time - pd.queue.st[qid];
 			pd.lastrun.endtime = curr_time;
 
 			// log station run
 			write_log(LOGDATA_STATION, curr_time); // LOG_TODO
+#if !defined(ARDUINO)
+			uint32_t volume = 0;
+			if(os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) {
+				// flow_last_gpm is in pulses per minute, the pulse rate in 1/100 units per pulse
+				uint32_t pulse_rate = (os.iopts[IOPT_PULSE_RATE_1]<<8) + os.iopts[IOPT_PULSE_RATE_0];
+				volume = (uint32_t)(flow_last_gpm * pd.lastrun.duration / 60 * pulse_rate);
+				// the sensor measures the flow of all open valves: share it evenly among
+				// this station and the (non-master) stations still running at its end
+				unsigned char nrunning = 1;
+				for(unsigned char i=0;i<os.nstations;i++) {
+					if(os.is_running(i) && os.status.mas != i+1 && os.status.mas2 != i+1) nrunning++;
+				}
+				volume /= nrunning;
+			}
+			OSRollup::add(sid, curr_time, pd.lastrun.duration, volume);
+#endif
 			push_message(NOTIFY_STATION_OFF, sid, pd.lastrun.duration);
 		}
 	}
 
 	// make necessary adjustments to sequential time stamps
 	int16_t station_delay = water_time_decode_signed(os.iopts[IOPT_STATION_DELAY_TIME]);
-	if (q->st + q->dur + station_delay == pd.last_seq_stop_times[gid]) { // if removing last station in group
+	if (gid < NUM_SEQ_GROUPS && pd.queue.end_time(qid) + station_delay == pd.last_seq_stop_times[gid]) { // if removing last station in group
 		pd.last_seq_stop_times[gid] = 0;
 	}
 
 	if (force_dequeue) {
 		pd.dequeue(qid);
-		pd.station_qid[sid] = 0xFF;
+		pd.set_station_qid(sid, 0xFF);
 	}
 }
 
@@ -1176,32 +1273,36 @@ void process_dynamic_events(time_os_t curr_time) {
 		 && os.status.sensor2_active)
 		sn2 = true;
 
-	// todo: handle sensor 2
-	unsigned char sid, s, bid, qid, igs, igs2, igrd;
-	for(bid=0;bid<os.nboards;bid++) {
-		igs = os.attrib_igs[bid];
-		igs2= os.attrib_igs2[bid];
-		igrd= os.attrib_igrd[bid];
-
-		for(s=0;s<8;s++) {
-			sid=bid*8+s;
-
+	if (en && !rd && !sn1 && !sn2) return; // nothing to turn off
+
+	// work on 64 stations at a time: a station must stop if the controller
+	// is disabled, or a rain delay / sensor is on and it does not ignore it
+	const uint64_t all = ~(uint64_t)0;
+	unsigned char sid, bid, qid, b;
+	for(unsigned char w=0; w*8<os.nboards; w++) {
+		uint64_t queued = 0, igrd = 0, igs = 0, igs2 = 0;
+		for(b=0; b<8 && (bid=w*8+b)<os.nboards; b++) {
+			queued |= (uint64_t)pd.queued_bits[bid] << (b*8);
+			igrd   |= (uint64_t)os.attrib_igrd[bid] << (b*8);
+			igs    |= (uint64_t)os.attrib_igs[bid]  << (b*8);
+			igs2   |= (uint64_t)os.attrib_igs2[bid] << (b*8);
+		}
+		uint64_t stop = en ? 0 : all;
+		if(rd)  stop |= ~igrd;
+		if(sn1) stop |= ~igs;
+		if(sn2) stop |= ~igs2;
+		stop &= queued;
+
+		while(stop) {
+			sid = w*64 + __builtin_ctzll(stop);
+			stop &= stop-1;
 			// ignore master stations because they are handled separately
 			if (os.status.mas == sid+1) continue;
 			if (os.status.mas2== sid+1) continue;
-			// If this is a normal program (not a run-once or test program)
-			// and either the controller is disabled, or
-			// if raining and ignore rain bit is cleared
-			// FIX ME
 			qid = pd.station_qid[sid];
-			if(qid==255) continue;
-			RuntimeQueueStruct *q = pd.queue + qid;
-
-			if(q->pid>=99) continue;  // if this is a manually started program, proceed
-			if(!en)	{q->deque_time=curr_time; turn_off_station(sid, curr_time);}  // if system is disabled, turn off zone
-			if(rd && !(igrd&(1<<s))) {q->deque_time=curr_time; turn_off_station(sid, curr_time);}  // if rain delay is on and zone does not ignore rain delay, turn it off
-			if(sn1&& !(igs &(1<<s))) {q->deque_time=curr_time; turn_off_station(sid, curr_time);}  // if sensor1 is on and zone does not ignore sensor1, turn it off
-			if(sn2&& !(igs2&(1<<s))) {q->deque_time=curr_time; turn_off_station(sid, curr_time);}  // if sensor2 is on and zone does not ignore sensor2, turn it off
+			if(pd.queue.pid[qid]>=99) continue;  // if this is a manually started program, proceed
+			pd.queue.deque_time[qid] = curr_time;
+			turn_off_station(sid, curr_time);
 		}
 	}
 }
@@ -1210,7 +1311,7 @@ void process_dynamic_events(time_os_t curr_time) {
  * this function determines the appropriate start and dequeue times
  * of stations bound to master stations with on and off adjustments
  */
-void handle_master_adjustments(time_os_t curr_time, RuntimeQueueStruct *q) {
+void handle_master_adjustments(time_os_t curr_time, unsigned char qid) {
 
 	int16_t start_adj = 0;
 	int16_t dequeue_adj = 0;
@@ -1219,7 +1320,7 @@ void handle_master_adjustments(time_os_t curr_time, RuntimeQueueStruct *q) {
 
 		unsigned char masid = os.masters[mas][MASOPT_SID];
 
-		if (masid && os.bound_to_master(q->sid, mas)) {
+		if (masid && os.bound_to_master(pd.queue.sid[qid], mas)) {
 
 			int16_t mas_on_adj = os.get_on_adj(mas);
 			int16_t mas_off_adj = os.get_off_adj(mas);
@@ -1231,11 +1332,47 @@ void handle_master_adjustments(time_os_t curr_time, RuntimeQueueStruct *q) {
 
 	// in case of negative master on adjustment
 	// push back station's start time to allow sufficient time to turn on master
-	if (q->st - curr_time < abs(start_adj)) {
-		q->st += abs(start_adj);
+	if (pd.queue.st[qid] - curr_time < abs(start_adj)) {
+		pd.queue.st[qid] += abs(start_adj);
 	}
 
-	q->deque_time = q->st + q->dur + dequeue_adj;
+	pd.queue.deque_time[qid] = pd.queue.end_time(qid) + dequeue_adj;
+}
+
+/** Compute the state of a master at curr_time
+ * A master is on while a queued station bound to it is within
+ * [st+on_adj, st+dur+off_adj]. The state can only change at one of these
+ * ends, so the earliest end ahead of curr_time is returned in until
+ * (0 if there is none).
+ */
+static unsigned char master_state(unsigned char mas, time_os_t curr_time, time_os_t *until) {
+	unsigned char mas_id = os.masters[mas][MASOPT_SID];
+	int16_t mas_on_adj = os.get_on_adj(mas);
+	int16_t mas_off_adj = os.get_off_adj(mas);
+	unsigned char masbit = 0;
+	time_os_t next = 0;
+
+	for(unsigned char sid = 0; sid < os.nstations; sid++) {
+		// skip if this is the master station
+		if (mas_id == sid + 1) continue;
+
+		unsigned char qid = pd.station_qid[sid];
+		if(qid==255) continue; // skip if station is not in the queue
+
+		if (os.bound_to_master(sid, mas)) {
+			time_os_t on_time = pd.queue.st[qid] + mas_on_adj;
+			time_os_t off_time = pd.queue.end_time(qid) + mas_off_adj + 1;
+			// check if timing is within the acceptable range
+			if (curr_time >= on_time && curr_time < off_time) {
+				masbit = 1;
+				if (!next || off_time < next) next = off_time;
+			} else if (on_time > curr_time) {
+				if (!next || on_time < next) next = on_time;
+			}
+		}
+	}
+	*until = next;
+	return masbit;
 }
 
 /** Scheduler
@@ -1257,30 +1394,33 @@ void schedule_all_stations(time_os_t curr_time) {
 			seq_start_times[i] = pd.last_seq_stop_times[i] + station_delay;
 		}
 	}
-	RuntimeQueueStruct *q = pd.queue;
 	unsigned char re = os.iopts[IOPT_REMOTE_EXT_MODE];
-	unsigned char gid;
+	unsigned char gid, sid, qid, nqid;
 
-	// go through runtime queue and calculate start time of each station
-	for(;q<pd.queue+pd.nqueue;q++) {
-		if(q->st) continue; // if this queue element has already been scheduled, skip
-		if(!q->dur) continue; // if the element has been marked to reset, skip
-		gid = os.get_station_gid(q->sid);
+	// go through the pending elements and calculate start time of each station
+	for(qid=pd.queue.head[QUEUE_LIST_PENDING];qid!=QUEUE_NONE;qid=nqid) {
+		nqid = pd.queue.next[qid];
+		if(!pd.queue.dur[qid]) continue; // if the element has been marked to reset, skip
+		sid = pd.queue.sid[qid];
+		gid = os.get_station_gid(sid);
 
 		// use sequential scheduling per sequential group
 		// apply station delay time
-		if (os.is_sequential_station(q->sid) && !re) {
-			q->st = seq_start_times[gid];
-			seq_start_times[gid] += q->dur;
+		if (os.is_sequential_station(sid) && !re) {
+			pd.queue.st[qid] = seq_start_times[gid];
+			seq_start_times[gid] += pd.queue.dur[qid];
 			seq_start_times[gid] += station_delay; // add station delay time
 		} else {
 			// otherwise, concurrent scheduling
-			q->st = con_start_time;
+			pd.queue.st[qid] = con_start_time;
 			// stagger concurrent stations by 1 second
 			con_start_time++;
 		}
 
-		handle_master_adjustments(curr_time, q);
+		handle_master_adjustments(curr_time, qid);
+		pd.queue.unlink(qid);
+		pd.queue.link_sorted(qid, RuntimeQueue::group_list(sid));
+		pd.master_dirty = true;
 
 		if (!os.status.program_busy) {
 			os.status.program_busy = 1;  // set program busy bit
@@ -1310,11 +1450,9 @@ void reset_all_stations_immediate() {
  * Stations will be logged
  */
 void reset_all_stations() {
-	RuntimeQueueStruct *q = pd.queue;
 	// go through runtime queue and assign water time to 0
-	for(;q<pd.queue+pd.nqueue;q++) {
-		q->dur = 0;
-	}
+	memset(pd.queue.dur, 0, pd.nqueue*sizeof(pd.queue.dur[0]));
+	pd.master_dirty = true;
 }
 
 
@@ -1347,12 +1485,7 @@ void manual_start_program(unsigned char pid, unsigned char uwt) {
 			dur = dur * os.iopts[IOPT_WATER_PERCENTAGE] / 100;
 		}
 		if(dur>0 && !(os.attrib_dis[bid]&(1<<s))) {
-			RuntimeQueueStruct *q = pd.enqueue();
-			if (q) {
-				q->st = 0;
-				q->dur = dur;
-				q->sid = sid;
-				q->pid = 254;
+			if (pd.enqueue(dur, sid, 254) != 0xFF) {
 				match_found = true;
 			}
 		}
@@ -1373,6 +1506,9 @@ void ip2string(char* str, size_t str_len, unsigned char ip[4]) {
 #define PUSH_PAYLOAD_LEN TMP_BUFFER_SIZE
 
 void push_message(int type, uint32_t lval, float fval, const char* sval) {
+#if defined(SIMULATION)
+	return;
+#endif
 	static char topic[PUSH_TOPIC_LEN+1];
 	static char payload[PUSH_PAYLOAD_LEN+1];
 	char* postval = tmp_buffer+1; // +1 so we can fit a opening { before the loaded config
@@ -1711,8 +1847,10 @@ void make_logfile_name(char *name) {
  * in program memory, and each name
  * must be strictly two characters with an ending 0
  * so each name is 3 characters total
+ * (declared extern so that binlog.cpp can use it)
  */
-static const char log_type_names[] PROGMEM =
+extern const char log_type_names[];
+const char log_type_names[] PROGMEM =
 	"  \0"
 	"s1\0"
 	"rd\0"
@@ -1726,14 +1864,65 @@ void write_log(unsigned char type, time_os_t curr_time) {
 
 	if (!os.iopts[IOPT_ENABLE_LOGGING]) return;
 
+	// collect the record fields: station records are [pid,sid,duration,time(,flow)],
+	// special records are [lvalue,"type",lvalue2,time]
+	ulong lvalue=0, lvalue2=0;
+	bool log_flow = (os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) && (type==LOGDATA_STATION);
+	if(type == LOGDATA_STATION) {
+		lvalue = pd.lastrun.duration;
+	} else {
+		if(type==LOGDATA_FLOWSENSE) {
+			lvalue = (flow_count>os.flowcount_log_start)?(flow_count-os.flowcount_log_start):0;
+		}
+
+		switch(type) {
+			case LOGDATA_FLOWSENSE:
+				lvalue2 = (curr_time>os.sensor1_active_lasttime)?(curr_time-os.sensor1_active_lasttime):0;
+				break;
+			case LOGDATA_SENSOR1:
+				lvalue2 = (curr_time>os.sensor1_active_lasttime)?(curr_time-os.sensor1_active_lasttime):0;
+				break;
+			case LOGDATA_SENSOR2:
+				lvalue2 = (curr_time>os.sensor2_active_lasttime)?(curr_time-os.sensor2_active_lasttime):0;
+				break;
+			case LOGDATA_RAINDELAY:
+				lvalue2 = (curr_time>os.raindelay_on_lasttime)?(curr_time-os.raindelay_on_lasttime):0;
+				break;
+			case LOGDATA_WATERLEVEL:
+				lvalue2 = os.iopts[IOPT_WATER_PERCENTAGE];
+				break;
+		}
+	}
+
+#if !defined(ARDUINO)
+	// RPI/BBB: fixed-size records in logs/xxxxx.bin, and the text line in logs/xxxxx.txt, see binlog.h
+	BinLogRecord rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.time = curr_time;
+	rec.type = type;
+	rec.value = lvalue;
+	if(type == LOGDATA_STATION) {
+		rec.pid = pd.lastrun.program;
+		rec.sid = pd.lastrun.station;
+		if(log_flow) {
+			rec.flags |= BINLOG_FLAG_FLOW;
+			memcpy(&rec.value2, &flow_last_gpm, sizeof(flow_last_gpm));
+		}
+	} else {
+		rec.value2 = lvalue2;
+	}
+#if defined(SIMULATION)
+	OSSim::log_record(rec);
+#else
+	OSBinLog::append(rec);
+#endif
+#else
 	// file name will be logs/xxxxx.tx where xxxxx is the day in epoch time
 	snprintf (tmp_buffer, TMP_BUFFER_SIZE, "%lu", curr_time / 86400);
 	make_logfile_name(tmp_buffer);
 
 	// Step 1: open file if exists, or create new otherwise,
 	// and move file pointer to the end
-#if defined(ARDUINO) // prepare log folder for Arduino
-
 	#if defined(ESP8266)
 	File file = LittleFS.open(tmp_buffer, "r+");
 	if(!file) {
@@ -1764,22 +1953,6 @@ void write_log(unsigned char type, time_os_t curr_time) {
 	}
 	#endif
 
-#else // prepare log folder for RPI/BBB
-	struct stat st;
-	if(stat(get_filename_fullpath(LOG_PREFIX), &st)) {
-		if(mkdir(get_filename_fullpath(LOG_PREFIX), S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IWGRP | S_IXGRP | S_IROTH | S_IWOTH | S_IXOTH)) {
-			return;
-		}
-	}
-	FILE *file;
-	file = fopen(get_filename_fullpath(tmp_buffer), "rb+");
-	if(!file) {
-		file = fopen(get_filename_fullpath(tmp_buffer), "wb");
-		if (!file)	return;
-	}
-	fseek(file, 0, SEEK_END);
-#endif	// prepare log folder
-
 	// Step 2: prepare data buffer
 	strcpy_P(tmp_buffer, PSTR("["));
 
@@ -1792,65 +1965,33 @@ void write_log(unsigned char type, time_os_t curr_time) {
 		strcat_P(tmp_buffer, PSTR(","));
 		// duration is unsigned integer
 		size = strlen(tmp_buffer);
-		snprintf(tmp_buffer + size, TMP_BUFFER_SIZE - size , "%lu", (ulong)pd.lastrun.duration);
+		snprintf(tmp_buffer + size, TMP_BUFFER_SIZE - size , "%lu", lvalue);
 
 	} else {
-		ulong lvalue=0;
-		if(type==LOGDATA_FLOWSENSE) {
-			lvalue = (flow_count>os.flowcount_log_start)?(flow_count-os.flowcount_log_start):0;
-		}
-
 		size_t size = strlen(tmp_buffer);
 		snprintf(tmp_buffer + size, TMP_BUFFER_SIZE - size , "%lu", lvalue);
 		strcat_P(tmp_buffer, PSTR(",\""));
 		strcat_P(tmp_buffer, log_type_names+type*3);
 		strcat_P(tmp_buffer, PSTR("\","));
-
-		switch(type) {
-			case LOGDATA_FLOWSENSE:
-				lvalue = (curr_time>os.sensor1_active_lasttime)?(curr_time-os.sensor1_active_lasttime):0;
-				break;
-			case LOGDATA_SENSOR1:
-				lvalue = (curr_time>os.sensor1_active_lasttime)?(curr_time-os.sensor1_active_lasttime):0;
-				break;
-			case LOGDATA_SENSOR2:
-				lvalue = (curr_time>os.sensor2_active_lasttime)?(curr_time-os.sensor2_active_lasttime):0;
-				break;
-			case LOGDATA_RAINDELAY:
-				lvalue = (curr_time>os.raindelay_on_lasttime)?(curr_time-os.raindelay_on_lasttime):0;
-				break;
-			case LOGDATA_WATERLEVEL:
-				lvalue = os.iopts[IOPT_WATER_PERCENTAGE];
-				break;
-		}
 		size = strlen(tmp_buffer);
-		snprintf(tmp_buffer + size, TMP_BUFFER_SIZE - size , "%lu", lvalue);
+		snprintf(tmp_buffer + size, TMP_BUFFER_SIZE - size , "%lu", lvalue2);
 	}
 	strcat_P(tmp_buffer, PSTR(","));
 	size_t size = strlen(tmp_buffer);
 	snprintf(tmp_buffer + size, TMP_BUFFER_SIZE - size , "%lu", curr_time);
-	if((os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) && (type==LOGDATA_STATION)) {
+	if(log_flow) {
 		// RAH implementation of flow sensor
 		strcat_P(tmp_buffer, PSTR(","));
-		#if defined(ARDUINO)
 		dtostrf(flow_last_gpm,5,2,tmp_buffer+strlen(tmp_buffer));
-		#else
-		size_t len = strlen(tmp_buffer);
-		snprintf(tmp_buffer + len, TMP_BUFFER_SIZE - len, "%5.2f", flow_last_gpm);
-		#endif
 	}
 	strcat_P(tmp_buffer, PSTR("]\r\n"));
 
-#if defined(ARDUINO)
 	#if defined(ESP8266)
 	file.write((const uint8_t*)tmp_buffer, strlen(tmp_buffer));
 	#else
 	file.write(tmp_buffer);
 	#endif
 	file.close();
-#else
-	fwrite(tmp_buffer, 1, strlen(tmp_buffer), file);
-	fclose(file);
 #endif
 }
 
@@ -1916,12 +2057,12 @@ void delete_log(char *name) {
 
 #else // delete_log implementation for RPI/BBB
 	if (strncmp(name, "all", 3) == 0) {
-		// delete the log folder
-		rmdir(get_filename_fullpath(LOG_PREFIX));
-		return;
+		// delete the log folder, and the totals derived from it
+		OSBinLog::remove_all();
+		OSRollup::clear();
 	} else {
-		make_logfile_name(name);
-		remove(get_filename_fullpath(tmp_buffer));
+		// text, binary and compressed files of the day
+		OSBinLog::remove_day(strtoul(name, NULL, 10));
 	}
 #endif
 }
@@ -2018,24 +2159,92 @@ static void perform_ntp_sync() {
 int main(int argc, char *argv[]) {
     // Disable buffering to work with systemctl journal
     setvbuf(stdout, NULL, _IOLBF, 0);
+#if defined(BENCHMARK)
+	// usage: OpenSprinkler-bench [filter]
+	return OSBench::run(argc > 1 ? argv[1] : NULL);
+#endif
+#if defined(UNITTEST)
+	// usage: OpenSprinkler-test [filter]
+	return OSTest::run(argc > 1 ? argv[1] : NULL);
+#endif
 	printf("Starting OpenSprinkler\n");
 
 	int opt;
-	while(-1 != (opt = getopt(argc, argv, "d:"))) {
+	bool convert_logs = false;
+	while(-1 != (opt = getopt(argc, argv, "d:c"))) {
 		switch(opt) {
 		case 'd':
 			set_data_dir(optarg);
 			break;
+		case 'c':
+			// move the text logs into the binary format (removing them) and exit
+			convert_logs = true;
+			break;
 		default:
 			// ignore options we don't understand
 			break;
 		}
 	}
 
+	if(convert_logs) {
+		printf("Converted %d log files\n", OSBinLog::convert_all());
+		return 0;
+	}
+
+#if defined(SIMULATION)
+	// usage: OpenSprinkler [-d data_dir] scenario
+	if(optind >= argc) {
+		printf("Usage: %s [-d data_dir] scenario\n", argv[0]);
+		return 1;
+	}
+	if(!OSSim::load(argv[optind])) return 1;
+#endif
+
+#if defined(GPIOMEM) && defined(OSPI)
+	// without the registers no valve could be switched
+	if(!gpiomem_available()) return 1;
+#endif
+
   do_setup();
+#if defined(SIMULATION)
+	return OSSim::run();
+#endif
+	OSReactor::init();
 
+	ulong web_scan_tick = (ulong)-1;
+	ulong web_linger = 0;
+	bool web_busy = false;
 	while(true) {
 		do_loop();
+		OSReactor::watch(REACTOR_SRC_HTTP, OSHttpClient::get_fd(), EPOLLIN);
+		OSReactor::watch(REACTOR_SRC_MQTT, os.mqtt.get_fd(), EPOLLIN);
+
+		// the web server does not expose its sockets: look them up once a second.
+		// While a connection is being served, its socket is not known either, so
+		// after web activity the sockets are set aside and the server polled for a while
+		bool cloud = os.otc_enabled();
+		if(web_busy && (long)(millis()-web_linger)>=0) {
+			web_busy = false;
+			web_scan_tick = (ulong)-1;
+		}
+		if(!web_busy && OSReactor::nticks!=web_scan_tick) {
+			web_scan_tick = OSReactor::nticks;
+			OSReactor::watch(REACTOR_SRC_WEB, OSReactor::find_socket(os.http_port(), true), EPOLLIN);
+			OSReactor::watch(REACTOR_SRC_CLOUD, cloud ? OSReactor::find_socket(os.otc.port, false) : -1, EPOLLIN);
+		}
+
+		// sleep until there is work or the next second: a flow sensor without edge
+		// events is polled every 1 ms, a web server socket that is not watched every REACTOR_POLL_MS
+		int timeout = -1;
+		if(os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW && !flow_irq) timeout = 1;
+		else if(web_busy || !OSReactor::watching(REACTOR_SRC_WEB) || (cloud && !OSReactor::watching(REACTOR_SRC_CLOUD))) timeout = REACTOR_POLL_MS;
+		unsigned int fired = OSReactor::wait(timeout);
+		if(fired & ((1<<REACTOR_SRC_WEB) | (1<<REACTOR_SRC_CLOUD))) {
+			OSReactor::watch(REACTOR_SRC_WEB, -1, 0);
+			OSReactor::watch(REACTOR_SRC_CLOUD, -1, 0);
+			web_busy = true;
+			web_linger = millis() + REACTOR_WEB_LINGER_MS;
+		}
 	}
 	return 0;
 }
@@ -29,6 +29,8 @@
 
 void turn_off_station(unsigned char sid, time_os_t curr_time, unsigned char shift=0);
 void schedule_all_stations(time_os_t curr_time);
+void handle_shift_remaining_stations(unsigned char qid, unsigned char gid, time_os_t curr_time);
+void update_last_seq_stop_times(time_os_t curr_time);
 void process_dynamic_events(time_os_t curr_time);
 void reset_all_stations();
 void reset_all_stations_immediate();
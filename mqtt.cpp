@@ -102,6 +102,8 @@ bool OSMqtt::_done_subscribed = false;		//Flag indicating if command topic has b
 
 extern uint16_t parse_listdata(char **p);
 extern unsigned char findKeyVal (const char *str,char *strbuf, uint16_t maxlen,const char *key,bool key_in_pgm=false,uint8_t *keyfound=NULL);
+extern void kv_table_parse(const char *str);
+extern void kv_table_clear();
 
 //****************************** COMMAND ACTIONS ******************************//
 
@@ -194,20 +196,15 @@ void manualRun(char *message){
 				DEBUG_LOGF("Cannot independently schedule master.\r\n");
 				return;
 			}
-			RuntimeQueueStruct *q = NULL;
 			unsigned char sqi = pd.station_qid[sid];
 			//check if station has schedule
 			if(sqi!=0xFF){
-				q = pd.queue+sqi;
+				pd.queue.set(sqi, timer, sid, 99);
 			}else{
-				q = pd.enqueue();
+				sqi = pd.enqueue(timer, sid, 99);
 			}
 			
-			if(q){
-				q->st = 0;
-				q->dur = timer;
-				q->sid = sid;
-				q->pid = 99;
+			if(sqi!=0xFF){
 				schedule_all_stations(curr_time);
 			}else{
 				DEBUG_LOGF("Queue is full.\r\n");
@@ -222,8 +219,8 @@ void manualRun(char *message){
 		if(findKeyVal(message, tmp_buffer, TMP_BUFFER_SIZE, PSTR("ssta"), true)){
 			ssta = atoi(tmp_buffer);
 		}
-		RuntimeQueueStruct *q = pd.queue + pd.station_qid[sid];
-		q->deque_time = curr_time;
+		unsigned char sqi = pd.station_qid[sid];
+		if(sqi!=0xFF) pd.queue.deque_time[sqi] = curr_time;
 		turn_off_station(sid, curr_time, ssta);
 	}
 	return;
@@ -280,12 +277,7 @@ void runOnceProgram(char *message){
 		s = sid&0x07;
 
 		if(dur > 0 && !(os.attrib_dis[bid]&(1<<s))){
-			RuntimeQueueStruct *q = pd.enqueue();
-			if(q){
-				q->st = 0;
-				q->dur = water_time_resolve(dur);
-				q->pid = 254;
-				q->sid = sid;
+			if(pd.enqueue(water_time_resolve(dur), sid, 254) != 0xFF){
 				match_found = true;
 			}
 		}
@@ -541,7 +533,9 @@ void subscribe_callback(const char *topic, unsigned char *payload, unsigned int
 	DEBUG_LOGF("Subscribe Callback\r\n");
 	payload[length] = 0; // properly end the message
 	char* message = (char*)payload;
+	kv_table_parse(message);  // one pass over the parameters for all the lookups below
 	if(!checkPassword(message)){
+		kv_table_clear();
 		return;
 	}
 
@@ -557,8 +551,8 @@ void subscribe_callback(const char *topic, unsigned char *payload, unsigned int
 		programStart(message);
 	}else{
 		DEBUG_LOGF("Unsupported mqtt subscribe request\r\n");
-		return;
 	}
+	kv_table_clear();
 }
 
 int OSMqtt::_subscribe(void){
@@ -697,7 +691,9 @@ void subscribe_callback(struct mosquitto *mosq, void *obj, const struct mosquitt
 	char *topic = message->topic;
 	char *msg = (char*)(message->payload);
 
+	kv_table_parse(msg);  // one pass over the parameters for all the lookups below
 	if(!checkPassword(msg)){
+		kv_table_clear();
 		return;
 	}
 
@@ -713,8 +709,8 @@ void subscribe_callback(struct mosquitto *mosq, void *obj, const struct mosquitt
 		programStart(msg);
 	}else{
 		DEBUG_LOGF("Invalid request\r\n");
-		return;
 	}
+	kv_table_clear();
 }
 
 int OSMqtt::_subscribe(void) {
@@ -731,6 +727,12 @@ int OSMqtt::_loop(void) {
 	return mosquitto_loop(mqtt_client, 0 , 1);
 }
 
+/** Socket of the broker connection, for the main loop to wait on (-1 if none) */
+int OSMqtt::get_fd(void) {
+	if (mqtt_client == NULL || !_enabled) return -1;
+	return mosquitto_socket(mqtt_client);
+}
+
 const char * OSMqtt::_state_string(int error) {
 	return mosquitto_strerror(error);
 }
@@ -53,6 +53,9 @@ private:
     static void publish(const char *topic, const char *payload);
     static void subscribe();
     static void loop(void);
+#if !defined(ARDUINO)
+    static int get_fd(void);
+#endif
     static char* get_pub_topic() { return _pub_topic; }
     static char* get_sub_topic() { return _sub_topic; }
 };
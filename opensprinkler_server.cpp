@@ -35,7 +35,7 @@
 	#define OTF_PARAMS_DEF const OTF::Request &req,OTF::Response &res
 	#define OTF_PARAMS req,res
 	#define FKV_SOURCE req
-	#define handle_return(x) {if(x==HTML_OK) res.writeBodyData(ether_buffer, strlen(ether_buffer)); else otf_send_result(req,res,x); return;}
+	#define handle_return(x) {if(x==HTML_OK) res.writeBodyData(ether_buffer, strlen(ether_buffer)); else otf_send_result(req,res,x); flush_res=NULL; return;}
 #else
 	extern EthernetClient *m_client;
 	#define OTF_PARAMS_DEF
@@ -61,6 +61,11 @@
 	#include <stdarg.h>
 	#include <stdlib.h>
 	#include "etherport.h"
+	#include "httpclient.h"
+	#include "telemetry.h"
+	#include "binlog.h"
+	#include "rollup.h"
+	#include "reactor.h"
 #endif
 
 extern char ether_buffer[];
@@ -76,6 +81,17 @@ static char* get_buffer = NULL;
 
 BufferFiller bfill;
 
+#if defined(USE_OTF)
+// response being written, so that bfill can push out chunks by itself
+static const OTF::Request *flush_req = NULL;
+static OTF::Response *flush_res = NULL;
+void send_packet(OTF_PARAMS_DEF);
+
+static void flush_ether_buffer() {
+	if(flush_res) send_packet(*flush_req, *flush_res);
+}
+#endif
+
 /* Check available space (number of bytes) in the Ethernet buffer */
 int available_ether_buffer() {
 	return ETHER_BUFFER_SIZE - (int)bfill.position();
@@ -128,6 +144,11 @@ static const char htmlReturnHome[] PROGMEM =
 ;
 
 #if defined(USE_OTF)
+/** Look up a parameter of an OTF request
+ * The library has already split the query into its own map and keeps no raw
+ * query string, so there is no table for these requests; a 200 station /cs
+ * spends about 1 ms in these lookups on a PC.
+ */
 unsigned char findKeyVal (const OTF::Request &req,char *strbuf, uint16_t maxlen,const char *key,bool key_in_pgm=false,uint8_t *keyfound=NULL) {
 #if defined(ARDUINO)
 	char* result = key_in_pgm ? req.getQueryParameter((const __FlashStringHelper *)key) : req.getQueryParameter(key);
@@ -145,11 +166,111 @@ unsigned char findKeyVal (const OTF::Request &req,char *strbuf, uint16_t maxlen,
 	return 0;
 }
 #endif
+
+/** Parameter table of one query string, built in one pass by kv_table_parse
+ * Each slot holds where a key and its value sit in the query. Keys are placed
+ * by hash with linear probing, so while the table is in place findKeyVal on
+ * that query probes a slot or two instead of scanning the whole text again.
+ * Values are kept as they appear in the query (not url-decoded).
+ */
+#if defined(OS_AVR)
+#define KV_TABLE_SIZE  32    // slots, a power of 2; weather replies only
+#else
+#define KV_TABLE_SIZE  128   // weather replies and MQTT commands (1 KB)
+#endif
+
+struct KeyValSlot {
+	uint16_t key;   // offset of the key in the query
+	uint16_t val;   // offset of the value
+	uint16_t vlen;
+	uint8_t klen;   // 0: empty slot
+};
+
+static KeyValSlot kv_slots[KV_TABLE_SIZE];
+static const char *kv_source = NULL;  // query the table was built from
+
+static inline bool kv_end(char c) {
+	return c==0 || c==' ' || c=='\n';
+}
+
+/** FNV-1a hash of a key of len characters */
+static uint16_t kv_hash(const char *key, uint16_t len, bool key_in_pgm) {
+	uint32_t h = 2166136261UL;
+	for(uint16_t n=0;n<len;n++) {
+		h = (h ^ (unsigned char)(key_in_pgm ? pgm_read_byte(key+n) : key[n])) * 16777619UL;
+	}
+	return (uint16_t)(h ^ (h>>16));
+}
+
+/** Build the table for the query str; findKeyVal(str, ...) uses it until kv_table_clear
+ * A query that does not fit is left to the plain scan.
+ */
+void kv_table_parse(const char *str) {
+	memset(kv_slots, 0, sizeof(kv_slots));
+	kv_source = NULL;
+	if(str==NULL) return;
+	uint16_t count = 0;
+	const char *p = str;
+	while(!kv_end(*p)) {
+		if(*p=='?' || *p=='&') { p++; continue; }
+		const char *k = p;
+		while(!kv_end(*p) && *p!='=' && *p!='&' && *p!='?') p++;
+		if(*p!='=') continue;  // a bare word has no value
+		uint16_t klen = p-k;
+		const char *v = ++p;
+		while(!kv_end(*p) && *p!='&') p++;
+		if(klen==0) continue;
+		if(klen>255 || p-str>0xFFFF || count>=KV_TABLE_SIZE*3/4) return;
+
+		uint16_t i = kv_hash(k, klen, false) & (KV_TABLE_SIZE-1);
+		for(;kv_slots[i].klen;i=(i+1)&(KV_TABLE_SIZE-1)) {
+			if(kv_slots[i].klen==klen && memcmp(str+kv_slots[i].key, k, klen)==0) break;
+		}
+		if(kv_slots[i].klen) continue;  // a repeated key: the first one counts
+		kv_slots[i].key = k-str;
+		kv_slots[i].klen = klen;
+		kv_slots[i].val = v-str;
+		kv_slots[i].vlen = p-v;
+		count++;
+	}
+	kv_source = str;
+}
+
+/** Drop the table, e.g. once the query buffer is changed or reused */
+void kv_table_clear() {
+	kv_source = NULL;
+}
+
+static unsigned char kv_table_find(char *strbuf, uint16_t maxlen, const char *key, bool key_in_pgm, uint8_t *keyfound) {
+	uint16_t klen = 0;
+	while(key_in_pgm ? pgm_read_byte(key+klen) : key[klen]) klen++;
+	uint16_t i = kv_hash(key, klen, key_in_pgm) & (KV_TABLE_SIZE-1);
+	for(;kv_slots[i].klen;i=(i+1)&(KV_TABLE_SIZE-1)) {
+		const KeyValSlot &s = kv_slots[i];
+		if(s.klen!=klen) continue;
+		const char *k = kv_source+s.key;
+		uint16_t n;
+		for(n=0;n<klen;n++) {
+			if(k[n] != (key_in_pgm ? (char)pgm_read_byte(key+n) : key[n])) break;
+		}
+		if(n<klen) continue;
+		// same as the scan: a value that does not fit counts as not found
+		if(s.vlen>=maxlen) break;
+		memcpy(strbuf, kv_source+s.val, s.vlen);
+		strbuf[s.vlen] = 0;
+		if(keyfound) *keyfound = 1;
+		return s.vlen;
+	}
+	if(keyfound) *keyfound = 0;
+	return 0;
+}
+
 unsigned char findKeyVal (const char *str,char *strbuf, uint16_t maxlen,const char *key,bool key_in_pgm=false,uint8_t *keyfound=NULL) {
 	uint8_t found=0;
 	uint16_t i=0;
 	const char *kp;
 	if(str==NULL||strbuf==NULL||key==NULL) {return 0;}
+	if(str==kv_source) return kv_table_find(strbuf, maxlen, key, key_in_pgm, keyfound);
 	kp=key;
 	if (key_in_pgm) {
 		// key is in program memory space
@@ -206,7 +327,11 @@ unsigned char findKeyVal (const char *str,char *strbuf, uint16_t maxlen,const ch
 }
 
 void rewind_ether_buffer() {
-    bfill = BufferFiller(ether_buffer, ETHER_BUFFER_SIZE*2);
+#if defined(USE_OTF)
+	bfill = BufferFiller(ether_buffer, ETHER_BUFFER_SIZE*2, flush_ether_buffer);
+#else
+	bfill = BufferFiller(ether_buffer, ETHER_BUFFER_SIZE*2);
+#endif
 	ether_buffer[0] = 0;
 }
 
@@ -226,6 +351,9 @@ char dec2hexchar(unsigned char dec) {
 
 #if defined(USE_OTF)
 void print_header(OTF_PARAMS_DEF, bool isJson=true, int len=0) {
+	// responses with a known length are written in one piece
+	flush_req = &req;
+	flush_res = len ? NULL : &res;
 	res.writeStatus(200, F("OK"));
 	res.writeHeader(F("Content-Type"), isJson?F("application/json"):F("text/html"));
 	if(len>0)
@@ -374,7 +502,18 @@ void on_ap_try_connect(OTF_PARAMS_DEF) {
 boolean check_password(char *p) {
 	return true;
 }
-boolean process_password(OTF_PARAMS_DEF, boolean fwv_on_fail=false)
+
+/** Verify the pw or tk parameter of a request
+ * token_ok is false where a session token cannot stand in for the password:
+ * changing the password (/sp) or the options (/co), and rebooting or updating
+ * through /cv, so that a leaked token cannot lock the owner out.
+ */
+boolean credentials_ok(const char *pw, const char *tk, boolean token_ok) {
+	if(token_ok && tk != NULL && os.session_verify(tk)) return true;
+	return pw != NULL && os.password_verify(pw);
+}
+
+boolean process_password(OTF_PARAMS_DEF, boolean fwv_on_fail=false, boolean token_ok=true)
 #else
 boolean check_password(char *p)
 #endif
@@ -396,8 +535,7 @@ boolean check_password(char *p)
 	/*if(req.isCloudRequest()){ // password is not required if this is coming from cloud connection
 		return true;
 	}*/
-	const char *pw = req.getQueryParameter("pw");
-	if(pw != NULL && os.password_verify(pw)) return true;
+	if(credentials_ok(req.getQueryParameter("pw"), req.getQueryParameter("tk"), token_ok)) return true;
 
 	/* if fwv_on_fail is true, output fwv if password check has failed */
 	if(fwv_on_fail) {
@@ -451,9 +589,9 @@ void server_json_stations_main(OTF_PARAMS_DEF) {
 	unsigned char sid;
 	for(sid=0;sid<os.nstations;sid++) {
 		os.get_station_name(sid, tmp_buffer);
-		bfill.emit_p(PSTR("\"$S\""), tmp_buffer);
+		bfill.emit_json_str(tmp_buffer, STATION_NAME_SIZE);
 		if(sid!=os.nstations-1)
-			bfill.emit_p(PSTR(","));
+			bfill.emit_char(',');
 		if (available_ether_buffer() <=0 ) {
 			send_packet(OTF_PARAMS);
 		}
@@ -576,6 +714,7 @@ void server_change_stations(OTF_PARAMS_DEF) {
 			os.set_station_name(sid, tmp_buffer);
 		}
 	}
+	os.stations_flush(); // names are written out together
 
 	server_change_board_attrib(FKV_SOURCE, 'm', os.attrib_mas); // master1
 	server_change_board_attrib(FKV_SOURCE, 'i', os.attrib_igrd); // ignore rain delay
@@ -584,10 +723,11 @@ void server_change_stations(OTF_PARAMS_DEF) {
 	server_change_board_attrib(FKV_SOURCE, 'n', os.attrib_mas2); // master2
 	server_change_board_attrib(FKV_SOURCE, 'd', os.attrib_dis); // disable
 	server_change_stations_attrib(FKV_SOURCE, 'g', os.attrib_grp); // sequential groups
+	pd.regroup_queue();
 	/* handle special data */
 	if(findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, PSTR("sid"), true)) {
 		sid = atoi(tmp_buffer);
-		if(sid<0 || sid>os.nstations) handle_return(HTML_DATA_OUTOFBOUND);
+		if(sid>=os.nstations) handle_return(HTML_DATA_OUTOFBOUND);
 		if(findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, PSTR("st"), true) &&
 			 findKeyVal(FKV_SOURCE, tmp_buffer+1, TMP_BUFFER_SIZE-1, PSTR("sd"), true)) {
 
@@ -616,8 +756,7 @@ void server_change_stations(OTF_PARAMS_DEF) {
 				}
 			}
 			// write spe data
-			file_write_block(STATIONS_FILENAME, tmp_buffer,
-				(uint32_t)sid*sizeof(StationData)+offsetof(StationData,type), STATION_SPECIAL_DATA_SIZE+1);
+			os.set_station_special(sid, tmp_buffer);
 
 		} else {
 
@@ -728,12 +867,7 @@ void server_change_runonce(OTF_PARAMS_DEF) {
 		// if non-zero duration is given
 		// and if the station has not been disabled
 		if (dur>0 && !(os.attrib_dis[bid]&(1<<s))) {
-			RuntimeQueueStruct *q = pd.enqueue();
-			if (q) {
-				q->st = 0;
-				q->dur = water_time_resolve(dur);
-				q->pid = 254;
-				q->sid = sid;
+			if (pd.enqueue(water_time_resolve(dur), sid, 254) != 0xFF) {
 				match_found = true;
 			}
 		}
@@ -1052,7 +1186,8 @@ void server_json_programs_main(OTF_PARAMS_DEF) {
 		bfill.emit_p(PSTR("$D],["), prog.starttimes[i]);	// this is the last element
 		// station water time
 		for (i=0; i<os.nstations-1; i++) {
-			bfill.emit_p(PSTR("$L,"),(unsigned long)prog.durations[i]);
+			bfill.emit_uint(prog.durations[i]);
+			bfill.emit_char(',');
 		}
 		bfill.emit_p(PSTR("$L],\""),(unsigned long)prog.durations[i]); // this is the last element
 		// program name
@@ -1168,6 +1303,10 @@ void server_json_controller_main(OTF_PARAMS_DEF) {
 	bfill.emit_p(PSTR("\"email\":{$O},"), SOPT_EMAIL_OPTS);
 #endif
 
+#if !defined(ARDUINO)
+	bfill.emit_p(PSTR("\"influx\":{$O},"), SOPT_INFLUX_OPTS);
+#endif
+
 #if defined(ARDUINO)
 	if(os.status.has_curr_sense) {
 		uint16_t current = os.read_current();
@@ -1193,13 +1332,12 @@ void server_json_controller_main(OTF_PARAMS_DEF) {
 		}
 		unsigned long rem = 0;
 		unsigned char qid = pd.station_qid[sid];
-		RuntimeQueueStruct *q = pd.queue + qid;
 		if (qid<255) {
-			rem = (curr_time >= q->st) ? (q->st+q->dur-curr_time) : q->dur;
+			rem = (curr_time >= pd.queue.st[qid]) ? (pd.queue.end_time(qid)-curr_time) : pd.queue.dur[qid];
 			if(rem>65535) rem = 0;
 		}
 		bfill.emit_p(PSTR("[$D,$L,$L,$D]"),
-		(qid<255)?q->pid:0, rem, (qid<255)?q->st:0, os.attrib_grp[sid]);
+		(qid<255)?pd.queue.pid[qid]:0, rem, (qid<255)?(uint32_t)pd.queue.st[qid]:0, os.attrib_grp[sid]);
 		bfill.emit_p((sid<os.nstations-1)?PSTR(","):PSTR("]"));
 	}
 
@@ -1269,7 +1407,7 @@ void server_change_values(OTF_PARAMS_DEF)
 {
 #if defined(USE_OTF)
 	extern uint32_t reboot_timer;
-	if(!process_password(OTF_PARAMS)) return;
+	if(!process_password(OTF_PARAMS, false, req.getQueryParameter("rbt") == NULL && req.getQueryParameter("update") == NULL)) return;
 #else
 	char *p = get_buffer;
 #endif
@@ -1394,7 +1532,7 @@ void server_change_scripturl(OTF_PARAMS_DEF) {
 void server_change_options(OTF_PARAMS_DEF)
 {
 #if defined(USE_OTF)
-	if(!process_password(OTF_PARAMS)) return;
+	if(!process_password(OTF_PARAMS, false, false)) return;
 #else
 	char *p = get_buffer;
 #endif
@@ -1507,6 +1645,19 @@ void server_change_options(OTF_PARAMS_DEF)
 		os.sopt_save(SOPT_EMAIL_OPTS, tmp_buffer);
 	}
 
+#if !defined(ARDUINO)
+	keyfound = 0;
+	if(findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, PSTR("influx"), true, &keyfound)) {
+		urlDecode(tmp_buffer);
+		os.sopt_save(SOPT_INFLUX_OPTS, tmp_buffer);
+		OSTelemetry::init();
+	} else if (keyfound) {
+		tmp_buffer[0]=0;
+		os.sopt_save(SOPT_INFLUX_OPTS, tmp_buffer);
+		OSTelemetry::init();
+	}
+#endif
+
 	if (findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, PSTR("dname"), true)) {
 		urlDecode(tmp_buffer);
 		strReplace(tmp_buffer, '\"', '\'');
@@ -1565,7 +1716,7 @@ void server_change_password(OTF_PARAMS_DEF) {
 #endif
 
 #if defined(USE_OTF)
-	if(!process_password(OTF_PARAMS)) return;
+	if(!process_password(OTF_PARAMS, false, false)) return;
 #else
 	char* p = get_buffer;
 #endif
@@ -1588,8 +1739,8 @@ void server_json_status_main() {
 	unsigned char sid;
 
 	for (sid=0;sid<os.nstations;sid++) {
-		bfill.emit_p(PSTR("$D"), (os.station_bits[(sid>>3)]>>(sid&0x07))&1);
-		if(sid!=os.nstations-1) bfill.emit_p(PSTR(","));
+		bfill.emit_char('0'+((os.station_bits[(sid>>3)]>>(sid&0x07))&1));
+		if(sid!=os.nstations-1) bfill.emit_char(',');
 	}
 	bfill.emit_p(PSTR("],\"nstations\":$D}"), os.nstations);
 }
@@ -1656,20 +1807,15 @@ void server_change_manual(OTF_PARAMS_DEF) {
 			if ((os.status.mas==sid+1) || (os.status.mas2==sid+1))
 				handle_return(HTML_NOT_PERMITTED);
 
-			RuntimeQueueStruct *q = NULL;
 			unsigned char sqi = pd.station_qid[sid];
 			// check if the station already has a schedule
 			if (sqi!=0xFF) {  // if so, we will overwrite the schedule
-				q = pd.queue+sqi;
+				pd.queue.set(sqi, timer, sid, 99);  // testing stations are assigned program index 99
 			} else {  // otherwise create a new queue element
-				q = pd.enqueue();
+				sqi = pd.enqueue(timer, sid, 99);
 			}
 			// if the queue is not full
-			if (q) {
-				q->st = 0;
-				q->dur = timer;
-				q->sid = sid;
-				q->pid = 99;  // testing stations are assigned program index 99
+			if (sqi!=0xFF) {
 				schedule_all_stations(curr_time);
 			} else {
 				handle_return(HTML_NOT_PERMITTED);
@@ -1683,8 +1829,8 @@ void server_change_manual(OTF_PARAMS_DEF) {
 			ssta = atoi(tmp_buffer);
 		}
 		// mark station for removal
-		RuntimeQueueStruct *q = pd.queue + pd.station_qid[sid];
-		q->deque_time = curr_time;
+		unsigned char sqi = pd.station_qid[sid];
+		if (sqi!=0xFF) pd.queue.deque_time[sqi] = curr_time;
 		turn_off_station(sid, curr_time, ssta);
 	}
 	handle_return(HTML_SUCCESS);
@@ -1705,6 +1851,133 @@ int file_fgets(File file, char* buf, int maxsize) {
 }
 #endif
 
+/** Apply the /jl type filter to a log line
+ * records are all in the form of [x,"xx",...]
+ * where x is program index (>0) if this is a station record
+ * and "xx" is the type name if this is a special record (e.g. wl, fl, rs)
+ */
+static bool json_log_line_match(const char *line, const char *type, bool type_specified) {
+	// search string until we find the first comma
+	const char *ptype = line;
+	while(*ptype && *ptype != ',') ptype++;
+	if(*ptype != ',') return false; // didn't find comma, move on
+	ptype++;  // move past comma
+
+	if (type_specified && strncmp(type, ptype+1, 2))
+		return false;
+	// if type is not specified, output everything except "wl" and "fl" records
+	if (!type_specified && (!strncmp("wl", ptype+1, 2) || !strncmp("fl", ptype+1, 2)))
+		return false;
+	return true;
+}
+
+#if !defined(ARDUINO)
+/** Record types that can pass the /jl type filter
+ * A name that is not a special record type can only match the text of
+ * station records, which is then checked line by line.
+ */
+static uint16_t json_log_type_mask(const char *type, bool type_specified) {
+	if(!type_specified) return ~((1<<LOGDATA_WATERLEVEL)|(1<<LOGDATA_FLOWSENSE));
+	int code = OSBinLog::type_code(type);
+	return (code>=0) ? (1<<code) : (1<<LOGDATA_STATION);
+}
+
+/** Output the binary records of a day, skipping unwanted days and types unparsed
+ * Returns false if the day has no binary log.
+ */
+static bool json_log_binary_day(BufferFiller &out, ulong day, const char *type, bool type_specified, uint16_t type_mask, bool &comma) {
+	BinLogReader reader;
+	if(!reader.open(day)) return false;
+	if(!(reader.header().type_mask & type_mask)) return true;
+	bool check_text = type_specified && OSBinLog::type_code(type)<0;
+	const BinLogRecord *rec;
+	while((rec = reader.next()) != NULL) {
+		if(rec->type>=BINLOG_NUM_TYPES || !(type_mask & (1<<rec->type))) continue;
+		OSBinLog::format(*rec, tmp_buffer, TMP_BUFFER_SIZE);
+		if(check_text && !json_log_line_match(tmp_buffer, type, type_specified)) continue;
+		if (comma)	out.emit_p(PSTR(","));
+		else {comma=1;}
+		out.emit_p(PSTR("$S"), tmp_buffer);
+	}
+	return true;
+}
+#endif
+
+/** Output the log records from day start to day end (inclusive) to out
+ * Does not write the enclosing brackets. out must be the response filler
+ * (or one that flushes itself), as full buffers are pushed out as they go.
+ */
+void json_log_days(BufferFiller &out, ulong start, ulong end, const char *type, bool type_specified) {
+	bool comma = 0;
+#if !defined(ARDUINO)
+	uint16_t type_mask = json_log_type_mask(type, type_specified);
+	OSBinLog::sync();  // include the records still queued for the writer
+#endif
+	for(unsigned int i=start;i<=end;i++) {
+#if !defined(ARDUINO)
+		// a binary log holds all records of its day, text ones included
+		if(json_log_binary_day(out, i, type, type_specified, type_mask, comma)) continue;
+#endif
+		snprintf(tmp_buffer, TMP_BUFFER_SIZE*2 , "%d", i);
+		make_logfile_name(tmp_buffer);
+
+#if defined(ESP8266)
+		File file = LittleFS.open(tmp_buffer, "r");
+		if(!file) continue;
+#elif defined(ARDUINO)
+		if (!sd.exists(tmp_buffer)) continue;
+		SdFile file;
+		file.open(tmp_buffer, O_READ);
+#else // prepare to open log file for RPI/BBB
+		FILE *file = fopen(get_filename_fullpath(tmp_buffer), "rb");
+		if(!file) continue;
+#endif // prepare to open log file
+		int result;
+		while(true) {
+		#if defined(ESP8266)
+			// do not use file.read_byte or read_byteUntil because it's very slow
+			result = file_fgets(file, tmp_buffer, TMP_BUFFER_SIZE);
+			if (result <= 0) {
+				file.close();
+				break;
+			}
+			tmp_buffer[result]=0;
+		#elif defined(ARDUINO)
+			result = file.fgets(tmp_buffer, TMP_BUFFER_SIZE);
+			if (result <= 0) {
+				file.close();
+				break;
+			}
+		#else
+			if(fgets(tmp_buffer, TMP_BUFFER_SIZE, file)) {
+				result = strlen(tmp_buffer);
+			} else {
+				result = 0;
+			}
+			if (result <= 0) {
+				fclose(file);
+				break;
+			}
+		#endif
+			// check record type
+			tmp_buffer[TMP_BUFFER_SIZE-1]=0; // make sure the search will end
+			if (!json_log_line_match(tmp_buffer, type, type_specified))
+				continue;
+			// if this is the first record, do not print comma
+			if (comma)	out.emit_p(PSTR(","));
+			else {comma=1;}
+			out.emit_p(PSTR("$S"), tmp_buffer);
+		#if !defined(USE_OTF)
+			// if the available ether buffer size is getting small
+			// push out a packet (with OTF, the filler pushes out its own chunks)
+			if (available_ether_buffer() <= 0) {
+				send_packet();
+			}
+		#endif
+		}
+	}
+}
+
 /**
  * Get log data
  * Command: /jl?start=x&end=x&hist=x&type=x
@@ -1766,78 +2039,7 @@ void server_json_log(OTF_PARAMS_DEF) {
 
 	bfill.emit_p(PSTR("["));
 
-	bool comma = 0;
-	for(unsigned int i=start;i<=end;i++) {
-		snprintf(tmp_buffer, TMP_BUFFER_SIZE*2 , "%d", i);
-		make_logfile_name(tmp_buffer);
-
-#if defined(ESP8266)
-		File file = LittleFS.open(tmp_buffer, "r");
-		if(!file) continue;
-#elif defined(ARDUINO)
-		if (!sd.exists(tmp_buffer)) continue;
-		SdFile file;
-		file.open(tmp_buffer, O_READ);
-#else // prepare to open log file for RPI/BBB
-		FILE *file = fopen(get_filename_fullpath(tmp_buffer), "rb");
-		if(!file) continue;
-#endif // prepare to open log file
-		int result;
-		while(true) {
-		#if defined(ESP8266)
-			// do not use file.read_byte or read_byteUntil because it's very slow
-			result = file_fgets(file, tmp_buffer, TMP_BUFFER_SIZE);
-			if (result <= 0) {
-				file.close();
-				break;
-			}
-			tmp_buffer[result]=0;
-		#elif defined(ARDUINO)
-			result = file.fgets(tmp_buffer, TMP_BUFFER_SIZE);
-			if (result <= 0) {
-				file.close();
-				break;
-			}
-		#else
-			if(fgets(tmp_buffer, TMP_BUFFER_SIZE, file)) {
-				result = strlen(tmp_buffer);
-			} else {
-				result = 0;
-			}
-			if (result <= 0) {
-				fclose(file);
-				break;
-			}
-		#endif
-			// check record type
-			// records are all in the form of [x,"xx",...]
-			// where x is program index (>0) if this is a station record
-			// and "xx" is the type name if this is a special record (e.g. wl, fl, rs)
-
-			// search string until we find the first comma
-			char *ptype = tmp_buffer;
-			tmp_buffer[TMP_BUFFER_SIZE-1]=0; // make sure the search will end
-			while(*ptype && *ptype != ',') ptype++;
-			if(*ptype != ',') continue; // didn't find comma, move on
-			ptype++;  // move past comma
-
-			if (type_specified && strncmp(type, ptype+1, 2))
-				continue;
-			// if type is not specified, output everything except "wl" and "fl" records
-			if (!type_specified && (!strncmp("wl", ptype+1, 2) || !strncmp("fl", ptype+1, 2)))
-				continue;
-			// if this is the first record, do not print comma
-			if (comma)	bfill.emit_p(PSTR(","));
-			else {comma=1;}
-			bfill.emit_p(PSTR("$S"), tmp_buffer);
-			// if the available ether buffer size is getting small
-			// push out a packet
-			if (available_ether_buffer() <= 0) {
-				send_packet(OTF_PARAMS);
-			}
-		}
-	}
-
+	json_log_days(bfill, start, end, type, type_specified);
 	bfill.emit_p(PSTR("]"));
 	handle_return(HTML_OK);
 }
@@ -1886,6 +2088,114 @@ void server_pause_queue(OTF_PARAMS_DEF) {
 	handle_return(HTML_SUCCESS);
 }
 
+#if !defined(ARDUINO)
+/** Output upcoming program runs
+ * Command: "/ju?pw=x"
+ * ur: list of [pid, start time], ordered by start time
+ */
+void server_json_upcoming(OTF_PARAMS_DEF) {
+#if defined(USE_OTF)
+	if(!process_password(OTF_PARAMS)) return;
+	rewind_ether_buffer();
+	print_header(OTF_PARAMS);
+#else
+	print_header();
+#endif
+	pd.start_index_peek(os.now_tz()); // bring the index up to date
+	unsigned char order[MAX_NUM_PROGRAMS];
+	unsigned char n = 0, i, pid;
+	for(pid=0;pid<pd.nprograms;pid++) {
+		if(!pd.next_found[pid]) continue;
+		for(i=n++; i>0 && pd.next_start[order[i-1]]>pd.next_start[pid]; i--) order[i] = order[i-1];
+		order[i] = pid;
+	}
+	bfill.emit_p(PSTR("{\"ur\":["));
+	for(i=0;i<n;i++) {
+		bfill.emit_p(PSTR("[$D,$L]"), order[i], (uint32_t)pd.next_start[order[i]]);
+		if(i!=n-1) bfill.emit_p(PSTR(","));
+	}
+	bfill.emit_p(PSTR("]}"));
+	handle_return(HTML_OK);
+}
+
+/** Output water usage totals per station
+ * Command: "/jw?pw=x&span=x&t=x"
+ * span: w (the 7 days ending on the day of t, default), m (the month of t) or y (the year of t)
+ * t:    a time in the span (epoch time, default: now); a span older than the
+ *       rollups kept, or after the current day or month, is out of bound
+ * Output: start and end (first and last second of the span), and per station
+ *         t: run time (seconds), n: number of runs, v: flow volume (1/100 units)
+ */
+void server_json_water(OTF_PARAMS_DEF) {
+#if defined(USE_OTF)
+	if(!process_password(OTF_PARAMS)) return;
+#else
+	char *p = get_buffer;
+#endif
+	unsigned char span = ROLLUP_SPAN_WEEK;
+	if (findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, PSTR("span"), true)) {
+		if (tmp_buffer[0]=='m') span = ROLLUP_SPAN_MONTH;
+		else if (tmp_buffer[0]=='y') span = ROLLUP_SPAN_YEAR;
+		else if (tmp_buffer[0]!='w') handle_return(HTML_DATA_OUTOFBOUND);
+	}
+	time_os_t now = os.now_tz();
+	time_os_t t = now;
+	if (findKeyVal(FKV_SOURCE, tmp_buffer, TMP_BUFFER_SIZE, PSTR("t"), true)) {
+		t = strtoul(tmp_buffer, NULL, 0);
+	}
+	static RollupEntry totals[MAX_NUM_STATIONS];
+	time_os_t start, end;
+	// t outside of the periods kept (62 days, 25 months)
+	if (!OSRollup::query(span, t, now, totals, &start, &end)) handle_return(HTML_DATA_OUTOFBOUND);
+
+#if defined(USE_OTF)
+	rewind_ether_buffer();
+	print_header(OTF_PARAMS);
+#else
+	print_header();
+#endif
+	bfill.emit_p(PSTR("{\"start\":$L,\"end\":$L,\"t\":["), (uint32_t)start, (uint32_t)end);
+	unsigned char sid;
+	for (sid=0; sid<os.nstations; sid++) {
+		if (sid) bfill.emit_char(',');
+		bfill.emit_uint(totals[sid].seconds);
+	}
+	bfill.emit_p(PSTR("],\"n\":["));
+	for (sid=0; sid<os.nstations; sid++) {
+		if (sid) bfill.emit_char(',');
+		bfill.emit_uint(totals[sid].runs);
+	}
+	bfill.emit_p(PSTR("],\"v\":["));
+	for (sid=0; sid<os.nstations; sid++) {
+		if (sid) bfill.emit_char(',');
+		bfill.emit_uint(totals[sid].volume);
+	}
+	bfill.emit_p(PSTR("]}"));
+	handle_return(HTML_OK);
+}
+#endif
+
+#if defined(USE_OTF)
+/**
+ * Start a session
+ * Command: /jt?pw=xxx
+ *
+ * pw: password
+ * Returns a token that other commands accept as tk=xxx in place of pw=xxx,
+ * for ttl seconds. Changing the password ends all sessions.
+ */
+void server_json_session(OTF_PARAMS_DEF) {
+	// a session needs the password itself, so it cannot be extended with a token
+	if(!os.iopts[IOPT_IGNORE_PASSWORD] && !credentials_ok(req.getQueryParameter("pw"), NULL, false)) handle_return(HTML_UNAUTHORIZED);
+	char token[SESSION_TOKEN_LEN+1];
+	if(!os.session_start(token)) handle_return(HTML_NOT_PERMITTED);
+	rewind_ether_buffer();
+	print_header(OTF_PARAMS);
+	bfill.emit_p(PSTR("{\"tk\":\"$S\",\"ttl\":$D}"), token, SESSION_TTL);
+	handle_return(HTML_OK);
+}
+#endif
+
 /** Output all JSON data, including jc, jp, jo, js, jn */
 void server_json_all(OTF_PARAMS_DEF) {
 #if defined(USE_OTF)
@@ -1924,6 +2234,7 @@ static int freeHeap () {
 #endif
 #else
 #include <sys/sysinfo.h>
+#include <sys/resource.h>
 static unsigned long freeHeap() {
 	//return sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
 	struct sysinfo info;
@@ -1973,7 +2284,25 @@ void server_json_debug(OTF_PARAMS_DEF) {
 */
 #else
 	(unsigned long)freeHeap());
-	bfill.emit_p(PSTR("}"));
+	bfill.emit_p(PSTR(",\"fcache\":{\"open\":$L,\"close\":$L,\"hit\":$L,\"read\":$L,\"write\":$L}"),
+		(uint32_t)file_cache_stats.opens, (uint32_t)file_cache_stats.closes, (uint32_t)file_cache_stats.hits,
+		(uint32_t)file_cache_stats.reads, (uint32_t)file_cache_stats.writes);
+	bfill.emit_p(PSTR(",\"http\":{\"sub\":$L,\"fail\":$L,\"pend\":$D}"),
+		(uint32_t)OSHttpClient::nsubmitted, (uint32_t)OSHttpClient::nfailed, OSHttpClient::pending());
+	bfill.emit_p(PSTR(",\"telemetry\":{\"rec\":$L,\"sent\":$L,\"drop\":$L}"),
+		(uint32_t)OSTelemetry::nrecorded, (uint32_t)OSTelemetry::nsent, (uint32_t)OSTelemetry::ndropped);
+	ulong log_written, log_dropped, log_batches;
+	OSBinLog::stats(log_written, log_dropped, log_batches);
+	bfill.emit_p(PSTR(",\"binlog\":{\"rec\":$L,\"drop\":$L,\"batch\":$L}"),
+		(uint32_t)log_written, (uint32_t)log_dropped, (uint32_t)log_batches);
+	// main loop wake-ups and process cpu time (ms) since start
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	ulong cpu_ms = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)*1000UL + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec)/1000;
+	bfill.emit_p(PSTR(",\"loop\":{\"wake\":$L,\"tick\":$L,\"cpu\":$L}"),
+		(uint32_t)OSReactor::nwakeups, (uint32_t)OSReactor::nticks, (uint32_t)cpu_ms);
+	bfill.emit_p(PSTR(",\"sr\":{\"out\":$L,\"skip\":$L}}"),
+		(uint32_t)os.nshiftouts, (uint32_t)os.nshiftskips);
 #endif
 	handle_return(HTML_OK);
 }
@@ -2032,8 +2361,14 @@ const char _url_keys[] PROGMEM =
 	"ja"
 	"pq"
     "db"
+#if defined(USE_OTF)
+	"jt"
+#endif
 #if defined(ARDUINO)
 	//"ff"
+#else
+	"ju"
+	"jw"
 #endif
 	;
 
@@ -2062,8 +2397,14 @@ URLHandler urls[] = {
 	server_json_all,        // ja
 	server_pause_queue,     // pq
 	server_json_debug,      // db
+#if defined(USE_OTF)
+	server_json_session,    // jt
+#endif
 #if defined(ARDUINO)
 	//server_fill_files,
+#else
+	server_json_upcoming,   // ju
+	server_json_water,      // jw
 #endif
 };
 
@@ -35,18 +35,40 @@ class BufferFiller {
 	char *start; //!< Pointer to start of buffer
 	char *ptr; //!< Pointer to cursor position
 	size_t len;
+	void (*flush_fn)(); //!< Optional: pushes out the buffer content once it is half full
 public:
 	BufferFiller () {}
-	BufferFiller (char *buf, size_t buffer_len) {
+	BufferFiller (char *buf, size_t buffer_len, void (*flush)()=NULL) {
 		start = buf;
 		ptr = buf;
 		len = buffer_len;
+		flush_fn = flush;
 	}
 
 	char* buffer () const { return start; }
 	size_t length () const { return len; }
 	unsigned int position () const { return ptr - start; }
 
+	/** Write an unsigned integer without going through snprintf */
+	static char* write_uint(char *p, uint32_t v) {
+		char digits[10];
+		unsigned char n = 0;
+		do {
+			digits[n++] = '0' + (v % 10);
+			v /= 10;
+		} while (v);
+		while (n) *p++ = digits[--n];
+		return p;
+	}
+
+	static char* write_int(char *p, int32_t v) {
+		if (v < 0) {
+			*p++ = '-';
+			return write_uint(p, (uint32_t)0 - (uint32_t)v);
+		}
+		return write_uint(p, (uint32_t)v);
+	}
+
 	void emit_p(PGM_P fmt, ...) {
 		va_list ap;
 		va_start(ap, fmt);
@@ -61,13 +83,11 @@ public:
 			c = pgm_read_byte(fmt++);
 			switch (c) {
 			case 'D':
-				// itoa(va_arg(ap, int), (char*) ptr, 10);  // ray
-				snprintf((char*) ptr, len - position(),  "%d", va_arg(ap, int));
-				break;
+				ptr = write_int(ptr, va_arg(ap, int));
+				continue;
 			case 'L':
-				// ultoa(va_arg(ap, uint32_t), (char*) ptr, 10);
-				snprintf((char*) ptr, len - position(), "%lu", (unsigned long) va_arg(ap, uint32_t));
-				break;
+				ptr = write_uint(ptr, va_arg(ap, uint32_t));
+				continue;
 			case 'S':
 				strcpy((char*) ptr, va_arg(ap, const char*));
 				break;
@@ -87,6 +107,7 @@ public:
 			case 'O': {
 				uint16_t oid = va_arg(ap, int);
 				file_read_block(SOPTS_FILENAME, (char*) ptr, oid*MAX_SOPTS_SIZE, MAX_SOPTS_SIZE);
+				ptr[MAX_SOPTS_SIZE] = 0;
 			}
 				break;
 			default:
@@ -97,8 +118,59 @@ public:
 		}
 		*(ptr)=0;
 		va_end(ap);
+		check_flush();
+	}
+
+	/** Typed writers for hot loops: no format string to interpret */
+	void emit_char(char c) {
+		*ptr++ = c;
+		*ptr = 0;
+		check_flush();
+	}
+
+	void emit_int(int32_t v) {
+		ptr = write_int(ptr, v);
+		*ptr = 0;
+		check_flush();
+	}
+
+	void emit_uint(uint32_t v) {
+		ptr = write_uint(ptr, v);
+		*ptr = 0;
+		check_flush();
+	}
+
+	/** Write a string as a quoted JSON string, escaping as needed */
+	void emit_json_str(const char *s, size_t maxlen) {
+		*ptr++ = '"';
+		for (size_t i = 0; i < maxlen && s[i]; i++) {
+			char c = s[i];
+			if (c == '"' || c == '\\') {
+				*ptr++ = '\\';
+				*ptr++ = c;
+			} else if ((unsigned char)c < 0x20) {
+				*ptr++ = '\\';
+				*ptr++ = 'u';
+				*ptr++ = '0';
+				*ptr++ = '0';
+				*ptr++ = dec2hexchar((c >> 4) & 0x0F);
+				*ptr++ = dec2hexchar(c & 0x0F);
+			} else {
+				*ptr++ = c;
+			}
+		}
+		*ptr++ = '"';
+		*ptr = 0;
+		check_flush();
+	}
+
+private:
+	// must be the last thing a writer does: flushing replaces this object
+	void check_flush() {
+		if (flush_fn && position()*2 >= len) flush_fn();
 	}
 };
 
+void json_log_days(BufferFiller &out, ulong start, ulong end, const char *type, bool type_specified);
 
 #endif // _OPENSPRINKLER_SERVER_H
@@ -34,10 +34,23 @@
 // Declare static data members
 unsigned char ProgramData::nprograms = 0;
 unsigned char ProgramData::nqueue = 0;
-RuntimeQueueStruct ProgramData::queue[RUNTIME_QUEUE_SIZE];
+RuntimeQueue ProgramData::queue;
 unsigned char ProgramData::station_qid[MAX_NUM_STATIONS];
+unsigned char ProgramData::queued_bits[MAX_NUM_BOARDS];
 LogStruct ProgramData::lastrun;
 time_os_t ProgramData::last_seq_stop_times[NUM_SEQ_GROUPS];
+bool ProgramData::master_dirty = true;
+#if !defined(ARDUINO)
+ProgramStruct ProgramData::programs[MAX_NUM_PROGRAMS];
+time_os_t ProgramData::next_start[MAX_NUM_PROGRAMS];
+unsigned char ProgramData::next_found[MAX_NUM_PROGRAMS];
+unsigned char ProgramData::start_heap[MAX_NUM_PROGRAMS];
+unsigned char ProgramData::nstart_heap = 0;
+bool ProgramData::start_index_dirty = true;
+time_os_t ProgramData::start_index_time = 0;
+uint16_t ProgramData::start_index_sunrise = 0;
+uint16_t ProgramData::start_index_sunset = 0;
+#endif
 
 extern char tmp_buffer[];
 
@@ -48,20 +61,25 @@ void ProgramData::init() {
 
 void ProgramData::reset_runtime() {
 	memset(station_qid, 0xFF, MAX_NUM_STATIONS);  // reset station qid to 0xFF
+	memset(queued_bits, 0, MAX_NUM_BOARDS);
 	nqueue = 0;
+	queue.clear_lists();
+	master_dirty = true;
 	memset(last_seq_stop_times, 0, sizeof(last_seq_stop_times));
 }
 
 /** Insert a new element to the queue
- * This function returns pointer to the next available element in the queue
- * and returns NULL if the queue is full
+ * This function fills the next available element in the queue
+ * and returns its index, or 0xFF if the queue is full
  */
-RuntimeQueueStruct* ProgramData::enqueue() {
+unsigned char ProgramData::enqueue(uint16_t dur, unsigned char sid, unsigned char pid) {
 	if (nqueue < RUNTIME_QUEUE_SIZE) {
-		nqueue ++;
-		return queue + (nqueue-1);
+		queue.list[nqueue] = QUEUE_NONE;
+		queue.set(nqueue, dur, sid, pid);
+		master_dirty = true;
+		return nqueue++;
 	} else {
-		return NULL;
+		return 0xFF;
 	}
 }
 
@@ -73,17 +91,116 @@ RuntimeQueueStruct* ProgramData::enqueue() {
 // this removes an element from the queue
 void ProgramData::dequeue(unsigned char qid) {
 	if (qid>=nqueue)	return;
+	queue.unlink(qid);
 	if (qid<nqueue-1) {
-		queue[qid] = queue[nqueue-1]; // copy the last element to the dequeud element to fill the space
-		if(station_qid[queue[qid].sid] == nqueue-1) // fix queue index if necessary
-			station_qid[queue[qid].sid] = qid;
+		queue.move(qid, nqueue-1); // copy the last element to the dequeud element to fill the space
+		if(station_qid[queue.sid[qid]] == nqueue-1) // fix queue index if necessary
+			station_qid[queue.sid[qid]] = qid;
 	}
 	nqueue--;
+	master_dirty = true;
+}
+
+/** Assign a queue element to a station (0xFF: none), keeping queued_bits in step */
+void ProgramData::set_station_qid(unsigned char sid, unsigned char qid) {
+	if (station_qid[sid] == qid) return;
+	station_qid[sid] = qid;
+	if (qid == 0xFF) queued_bits[sid>>3] &= ~(1<<(sid&0x07));
+	else queued_bits[sid>>3] |= (1<<(sid&0x07));
+	master_dirty = true;
+}
+
+/** Re-file every scheduled element on the list of its station's current group */
+void ProgramData::regroup_queue() {
+	unsigned char qid;
+	for (qid = 0; qid < nqueue; qid++) {
+		if (queue.list[qid] != QUEUE_LIST_PENDING) queue.unlink(qid);
+	}
+	for (qid = 0; qid < nqueue; qid++) {
+		if (queue.list[qid] == QUEUE_NONE) queue.link_sorted(qid, RuntimeQueue::group_list(queue.sid[qid]));
+	}
+}
+
+/** Fill an element as unscheduled and put it at the end of the pending list */
+void RuntimeQueue::set(unsigned char qid, uint16_t _dur, unsigned char _sid, unsigned char _pid) {
+	if (list[qid] != QUEUE_NONE) unlink(qid);
+	st[qid] = 0;  // not scheduled yet
+	deque_time[qid] = 0;
+	dur[qid] = _dur;
+	sid[qid] = _sid;
+	pid[qid] = _pid;
+	link(qid, QUEUE_LIST_PENDING);
+	ProgramData::master_dirty = true;
+}
+
+/** Move element from to index to, taking over its place on its list */
+void RuntimeQueue::move(unsigned char to, unsigned char from) {
+	st[to] = st[from];
+	deque_time[to] = deque_time[from];
+	dur[to] = dur[from];
+	sid[to] = sid[from];
+	pid[to] = pid[from];
+	unsigned char l = list[from];
+	prev[to] = prev[from];
+	next[to] = next[from];
+	list[to] = l;
+	list[from] = QUEUE_NONE;
+	if (l == QUEUE_NONE) return;
+	if (prev[to] != QUEUE_NONE) next[prev[to]] = to; else head[l] = to;
+	if (next[to] != QUEUE_NONE) prev[next[to]] = to; else tail[l] = to;
+}
+
+/** List a scheduled station belongs to: its sequential group, or the parallel list */
+unsigned char RuntimeQueue::group_list(unsigned char sid) {
+	unsigned char gid = os.get_station_gid(sid);
+	return (os.is_sequential_station(sid) && gid < NUM_SEQ_GROUPS) ? gid : QUEUE_LIST_PARALLEL;
+}
+
+void RuntimeQueue::clear_lists() {
+	memset(head, QUEUE_NONE, sizeof(head));
+	memset(tail, QUEUE_NONE, sizeof(tail));
+}
+
+/** Append an element to the end of a list */
+void RuntimeQueue::link(unsigned char qid, unsigned char l) {
+	list[qid] = l;
+	next[qid] = QUEUE_NONE;
+	prev[qid] = tail[l];
+	if (tail[l] != QUEUE_NONE) next[tail[l]] = qid; else head[l] = qid;
+	tail[l] = qid;
+}
+
+/** Insert an element by start time, after any element with the same start time */
+void RuntimeQueue::link_sorted(unsigned char qid, unsigned char l) {
+	// new elements usually start last, so search from the tail
+	unsigned char p = tail[l];
+	while (p != QUEUE_NONE && st[p] > st[qid]) p = prev[p];
+	list[qid] = l;
+	prev[qid] = p;
+	next[qid] = (p != QUEUE_NONE) ? next[p] : head[l];
+	if (p != QUEUE_NONE) next[p] = qid; else head[l] = qid;
+	if (next[qid] != QUEUE_NONE) prev[next[qid]] = qid; else tail[l] = qid;
+}
+
+void RuntimeQueue::unlink(unsigned char qid) {
+	unsigned char l = list[qid];
+	if (l == QUEUE_NONE) return;
+	if (prev[qid] != QUEUE_NONE) next[prev[qid]] = next[qid]; else head[l] = next[qid];
+	if (next[qid] != QUEUE_NONE) prev[next[qid]] = prev[qid]; else tail[l] = prev[qid];
+	list[qid] = QUEUE_NONE;
 }
 
 /** Load program count from program file */
 void ProgramData::load_count() {
 	nprograms = file_read_byte(PROG_FILENAME, 0);
+#if !defined(ARDUINO)
+	if (nprograms > MAX_NUM_PROGRAMS) nprograms = MAX_NUM_PROGRAMS;
+	// load all programs in one go
+	if (nprograms) {
+		file_read_block(PROG_FILENAME, programs, 1, (ulong)nprograms*PROGRAMSTRUCT_SIZE);
+	}
+	start_index_invalidate();
+#endif
 }
 
 /** Save program count to program file */
@@ -95,19 +212,30 @@ void ProgramData::save_count() {
 void ProgramData::eraseall() {
 	nprograms = 0;
 	save_count();
+#if !defined(ARDUINO)
+	start_index_invalidate();
+#endif
 }
 
 /** Read a program from program file*/
 void ProgramData::read(unsigned char pid, ProgramStruct *buf) {
 	if (pid >= nprograms) return;
+#if defined(ARDUINO)
 	// first unsigned char is program counter, so 1+
 	file_read_block(PROG_FILENAME, buf, 1+(ulong)pid*PROGRAMSTRUCT_SIZE, PROGRAMSTRUCT_SIZE);
+#else
+	memcpy(buf, programs+pid, PROGRAMSTRUCT_SIZE);
+#endif
 }
 
 /** Add a program */
 unsigned char ProgramData::add(ProgramStruct *buf) {
 	if (nprograms >= MAX_NUM_PROGRAMS)	return 0;
 	file_write_block(PROG_FILENAME, buf, 1+(ulong)nprograms*PROGRAMSTRUCT_SIZE, PROGRAMSTRUCT_SIZE);
+#if !defined(ARDUINO)
+	memcpy(programs+nprograms, buf, PROGRAMSTRUCT_SIZE);
+	start_index_invalidate();
+#endif
 	nprograms ++;
 	save_count();
 	return 1;
@@ -118,12 +246,21 @@ void ProgramData::moveup(unsigned char pid) {
 	if(pid >= nprograms || pid == 0) return;
 	// swap program pid-1 and pid
 	ulong pos = 1+(ulong)(pid-1)*PROGRAMSTRUCT_SIZE;
+#if defined(ARDUINO)
 	ulong next = pos+PROGRAMSTRUCT_SIZE;
 	char buf2[PROGRAMSTRUCT_SIZE];
 	file_read_block(PROG_FILENAME, tmp_buffer, pos, PROGRAMSTRUCT_SIZE);
 	file_read_block(PROG_FILENAME, buf2, next, PROGRAMSTRUCT_SIZE);
 	file_write_block(PROG_FILENAME, tmp_buffer, next, PROGRAMSTRUCT_SIZE);
 	file_write_block(PROG_FILENAME, buf2, pos, PROGRAMSTRUCT_SIZE);
+#else
+	ProgramStruct tmp = programs[pid-1];
+	programs[pid-1] = programs[pid];
+	programs[pid] = tmp;
+	// both records are adjacent, so write them back in one block
+	file_write_block(PROG_FILENAME, programs+pid-1, pos, 2*PROGRAMSTRUCT_SIZE);
+	start_index_invalidate();
+#endif
 }
 
 void ProgramData::toggle_pause(ulong delay) {
@@ -138,36 +275,41 @@ void ProgramData::toggle_pause(ulong delay) {
 }
 
 void ProgramData::set_pause() {
-	RuntimeQueueStruct *q = queue;
 	time_os_t curr_t = os.now_tz();
 
-	for (; q < queue + nqueue; q++) {
+	// running elements restart at curr_t+pause and the rest move by the pause,
+	// so the start time order of the group lists is kept
+	for (unsigned char qid = 0; qid < nqueue; qid++) {
 
-		turn_off_station(q->sid, curr_t);
-		if (curr_t>=q->st+q->dur) { // already finished running
+		turn_off_station(queue.sid[qid], curr_t);
+		if (curr_t>=queue.end_time(qid)) { // already finished running
 			continue;
-		} else if (curr_t>=q->st) { // currently running
-			q->dur -= (curr_t - q->st); // adjust remaining run time
-			q->st = curr_t + os.pause_timer;     // push back start time
+		} else if (curr_t>=queue.st[qid]) { // currently running
+			queue.dur[qid] -= (curr_t - queue.st[qid]); // adjust remaining run time
+			queue.st[qid] = curr_t + os.pause_timer;     // push back start time
 		} else { // scheduled but not running yet
-			q->st += os.pause_timer;
+			queue.st[qid] += os.pause_timer;
 		}
-		q->deque_time += os.pause_timer;
-		unsigned char gid = os.get_station_gid(q->sid);
-		if (q->st + q->dur > last_seq_stop_times[gid]) {
-			last_seq_stop_times[gid] = q->st + q->dur; // update last_seq_stop_times of the corresponding group
+		queue.deque_time[qid] += os.pause_timer;
+		unsigned char gid = os.get_station_gid(queue.sid[qid]);
+		if (gid >= NUM_SEQ_GROUPS) continue; // parallel station (PARALLEL_GROUP_ID)
+		if (queue.end_time(qid) > last_seq_stop_times[gid]) {
+			last_seq_stop_times[gid] = queue.end_time(qid); // update last_seq_stop_times of the corresponding group
 		}
 	}
+	master_dirty = true;
 }
 
 void ProgramData::resume_stations() {
-	RuntimeQueueStruct *q = queue;
-	for (; q < queue + nqueue; q++) {
-		q->st -= os.pause_timer;
-		q->deque_time -= os.pause_timer;
-		q->st += 1; // adjust by 1 second to give time for scheduler
-		q->deque_time += 1;
+	// adjust by 1 second to give time for scheduler
+	time_os_t shift = (time_os_t)os.pause_timer - 1;
+	for (unsigned char qid = 0; qid < nqueue; qid++) {
+		queue.st[qid] -= shift;
+	}
+	for (unsigned char qid = 0; qid < nqueue; qid++) {
+		queue.deque_time[qid] -= shift;
 	}
+	master_dirty = true;
 	clear_pause();
 }
 
@@ -182,6 +324,10 @@ unsigned char ProgramData::modify(unsigned char pid, ProgramStruct *buf) {
 	if (pid >= nprograms)  return 0;
 	ulong pos = 1+(ulong)pid*PROGRAMSTRUCT_SIZE;
 	file_write_block(PROG_FILENAME, buf, pos, PROGRAMSTRUCT_SIZE);
+#if !defined(ARDUINO)
+	memcpy(programs+pid, buf, PROGRAMSTRUCT_SIZE);
+	start_index_invalidate();
+#endif
 	return 1;
 }
 
@@ -189,11 +335,20 @@ unsigned char ProgramData::modify(unsigned char pid, ProgramStruct *buf) {
 unsigned char ProgramData::del(unsigned char pid) {
 	if (pid >= nprograms)  return 0;
 	if (nprograms == 0) return 0;
+#if defined(ARDUINO)
 	ulong pos = 1+(ulong)(pid+1)*PROGRAMSTRUCT_SIZE;
 	// erase by copying backward
 	for (; pos < 1+(ulong)nprograms*PROGRAMSTRUCT_SIZE; pos+=PROGRAMSTRUCT_SIZE) {
 		file_copy_block(PROG_FILENAME, pos, pos-PROGRAMSTRUCT_SIZE, PROGRAMSTRUCT_SIZE, tmp_buffer);
 	}
+#else
+	// shift the remaining programs down and write them back in one block
+	if (pid < nprograms-1) {
+		memmove(programs+pid, programs+pid+1, (ulong)(nprograms-1-pid)*PROGRAMSTRUCT_SIZE);
+		file_write_block(PROG_FILENAME, programs+pid, 1+(ulong)pid*PROGRAMSTRUCT_SIZE, (ulong)(nprograms-1-pid)*PROGRAMSTRUCT_SIZE);
+	}
+	start_index_invalidate();
+#endif
 	nprograms --;
 	save_count();
 	return 1;
@@ -202,10 +357,18 @@ unsigned char ProgramData::del(unsigned char pid) {
 // set the enable bit
 unsigned char ProgramData::set_flagbit(unsigned char pid, unsigned char bid, unsigned char value) {
 	if (pid >= nprograms)  return 0;
+#if defined(ARDUINO)
 	unsigned char flag = file_read_byte(PROG_FILENAME, 1+(ulong)pid*PROGRAMSTRUCT_SIZE);
+#else
+	unsigned char flag = *(unsigned char*)(programs+pid); // flag bits are the first byte of the struct
+#endif
 	if(value) flag|=(1<<bid);
 	else flag&=(~(1<<bid));
 	file_write_byte(PROG_FILENAME, 1+(ulong)pid*PROGRAMSTRUCT_SIZE, flag);
+#if !defined(ARDUINO)
+	*(unsigned char*)(programs+pid) = flag;
+	start_index_invalidate();
+#endif
 	return 1;
 }
 
@@ -343,6 +506,140 @@ unsigned char ProgramStruct::check_match(time_os_t t) {
 	return 0;
 }
 
+#if !defined(ARDUINO)
+#define NEXT_MATCH_HORIZON_DAYS 366
+
+/** Find the first minute at or after t at which check_match is true
+ * Candidate minutes are generated per day from the start times (including
+ * repeats that run over into the next day) and confirmed with check_match.
+ * If nothing matches within the horizon, *found is cleared and the end of
+ * the horizon is returned so the caller can search again from there.
+ */
+time_os_t ProgramStruct::next_match(time_os_t t, bool *found) {
+	*found = false;
+	t -= t%60;
+	time_os_t day_t = t - t%SECS_PER_DAY;
+	if (!enabled) return day_t + NEXT_MATCH_HORIZON_DAYS*SECS_PER_DAY;
+
+	int32_t start = starttime_decode(starttimes[0]);
+	int32_t repeat = starttimes[1];
+	int32_t interval = starttimes[2];
+	int32_t m;
+	bool prev_match = check_day_match(day_t-SECS_PER_DAY);
+	for(uint16_t d=0; d<NEXT_MATCH_HORIZON_DAYS; d++, day_t+=SECS_PER_DAY) {
+		bool curr_match = check_day_match(day_t);
+		int32_t best = 1440;
+		if (curr_match) {
+			if (starttime_type) {
+				for(unsigned char i=0;i<MAX_NUM_STARTTIMES;i++) {
+					m = starttime_decode(starttimes[i]);
+					if (m>=0 && m<best && day_t+m*60>=t) best = m;
+				}
+			} else {
+				for(int32_t c=0; c==0 || (interval && c<=repeat); c++) {
+					m = start + c*interval;
+					if (m>=1440) break;
+					if (m>=0 && day_t+m*60>=t) { best = m; break; }
+				}
+			}
+		}
+		if (prev_match && !starttime_type && interval) {
+			// repeats of a program that started the previous day and runs over night
+			for(int32_t c=0; c<=repeat; c++) {
+				m = start + c*interval - 1440;
+				if (m>=best) break;
+				if (m>=0 && day_t+m*60>=t) { best = m; break; }
+			}
+		}
+		if (best<1440) {
+			// confirm with check_match; if it disagrees, return a recheck time instead
+			*found = check_match(day_t+best*60);
+			return day_t+best*60+(*found ? 0 : 60);
+		}
+		prev_match = curr_match;
+	}
+	return day_t;
+}
+
+void ProgramData::start_heap_push(unsigned char pid) {
+	unsigned char i = nstart_heap++;
+	while (i>0) {
+		unsigned char parent = (i-1)/2;
+		if (next_start[start_heap[parent]] <= next_start[pid]) break;
+		start_heap[i] = start_heap[parent];
+		i = parent;
+	}
+	start_heap[i] = pid;
+}
+
+unsigned char ProgramData::start_heap_pop() {
+	unsigned char top = start_heap[0];
+	unsigned char last = start_heap[--nstart_heap];
+	unsigned char i = 0;
+	while (true) {
+		unsigned char child = 2*i+1;
+		if (child >= nstart_heap) break;
+		if (child+1 < nstart_heap && next_start[start_heap[child+1]] < next_start[start_heap[child]]) child++;
+		if (next_start[last] <= next_start[start_heap[child]]) break;
+		start_heap[i] = start_heap[child];
+		i = child;
+	}
+	if (nstart_heap) start_heap[i] = last;
+	return top;
+}
+
+/** Rebuild the next start time index if programs, sunrise/sunset times
+ * or the clock (e.g. time zone change or NTP correction) have changed
+ */
+void ProgramData::start_index_update(time_os_t t) {
+	if (!start_index_dirty && t+60>=start_index_time &&
+			start_index_sunrise==os.nvdata.sunrise_time && start_index_sunset==os.nvdata.sunset_time) {
+		start_index_time = t;
+		return;
+	}
+	bool found;
+	nstart_heap = 0;
+	for(unsigned char pid=0; pid<nprograms; pid++) {
+		next_start[pid] = programs[pid].next_match(t, &found);
+		next_found[pid] = found;
+		start_heap_push(pid);
+	}
+	start_index_dirty = false;
+	start_index_time = t;
+	start_index_sunrise = os.nvdata.sunrise_time;
+	start_index_sunset = os.nvdata.sunset_time;
+}
+
+/** Collect programs that start at time t
+ * The pids are returned in ascending order, same as a full scan would produce.
+ * Their next start times are advanced past the current minute.
+ */
+unsigned char ProgramData::start_index_pop(time_os_t t, unsigned char *pids) {
+	start_index_update(t);
+	unsigned char n = 0;
+	while (nstart_heap && next_start[start_heap[0]] <= t) {
+		unsigned char pid = start_heap_pop();
+		if (programs[pid].check_match(t)) {
+			// insert in ascending order
+			unsigned char i = n++;
+			for(; i>0 && pids[i-1]>pid; i--) pids[i] = pids[i-1];
+			pids[i] = pid;
+		}
+		bool found;
+		next_start[pid] = programs[pid].next_match(t-t%60+60, &found);
+		next_found[pid] = found;
+		start_heap_push(pid);
+	}
+	return n;
+}
+
+/** Earliest upcoming start time of all programs */
+time_os_t ProgramData::start_index_peek(time_os_t t) {
+	start_index_update(t);
+	return nstart_heap ? next_start[start_heap[0]] : 0;
+}
+#endif
+
 // convert absolute remainder (reference time 1970 01-01) to relative remainder (reference time today)
 // absolute remainder is stored in flash, relative remainder is presented to web
 void ProgramData::drem_to_relative(unsigned char days[2]) {
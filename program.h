@@ -106,6 +106,9 @@ public:
 	int16_t daterange[2] = {MIN_ENCODED_DATE, MAX_ENCODED_DATE}; // date range: start date, end date
 	unsigned char check_match(time_os_t t);
 	int16_t starttime_decode(int16_t t);
+#if !defined(ARDUINO)
+	time_os_t next_match(time_os_t t, bool *found);
+#endif
 
 protected:
 
@@ -115,23 +118,67 @@ protected:
 
 extern OpenSprinkler os;
 
-class RuntimeQueueStruct {
+#define QUEUE_NONE           0xFF  // no element / not on a list
+#define QUEUE_LIST_PARALLEL  NUM_SEQ_GROUPS      // scheduled elements of parallel stations
+#define QUEUE_LIST_PENDING   (NUM_SEQ_GROUPS+1)  // elements waiting to be scheduled, in enqueue order
+#define NUM_QUEUE_LISTS      (NUM_SEQ_GROUPS+2)
+
+/** Runtime queue, stored as parallel arrays
+ * The per-second scans read only one or two fields of each element,
+ * so every field is kept contiguous and free of struct padding.
+ * Elements are addressed by their queue index (qid).
+ *
+ * Each element is also on one doubly linked list: the pending list until
+ * it is scheduled, then the list of its sequential group (or the parallel
+ * list), which is kept ordered by start time. Work on one group walks
+ * only that group's list.
+ */
+class RuntimeQueue {
 public:
-	time_os_t   st;  // start time
-	uint16_t dur; // water time
-	unsigned char  sid;
-	unsigned char  pid;
-	time_os_t   deque_time; // deque time, which can be larger than st+dur to allow positive master off adjustment time
+	time_os_t   st[RUNTIME_QUEUE_SIZE];  // start time
+	time_os_t   deque_time[RUNTIME_QUEUE_SIZE]; // deque time, which can be larger than st+dur to allow positive master off adjustment time
+	uint16_t dur[RUNTIME_QUEUE_SIZE]; // water time
+	unsigned char  sid[RUNTIME_QUEUE_SIZE];
+	unsigned char  pid[RUNTIME_QUEUE_SIZE];
+
+	unsigned char  prev[RUNTIME_QUEUE_SIZE];
+	unsigned char  next[RUNTIME_QUEUE_SIZE];
+	unsigned char  list[RUNTIME_QUEUE_SIZE];  // list the element is on
+	unsigned char  head[NUM_QUEUE_LISTS];
+	unsigned char  tail[NUM_QUEUE_LISTS];
+
+	time_os_t end_time(unsigned char qid) const { return st[qid] + dur[qid]; }
+	void set(unsigned char qid, uint16_t _dur, unsigned char _sid, unsigned char _pid);
+	void move(unsigned char to, unsigned char from);
+
+	static unsigned char group_list(unsigned char sid);
+	void clear_lists();
+	void link(unsigned char qid, unsigned char l);
+	void link_sorted(unsigned char qid, unsigned char l);
+	void unlink(unsigned char qid);
 };
 
 class ProgramData {
 public:
-	static RuntimeQueueStruct queue[];
+	static RuntimeQueue queue;
 	static unsigned char nqueue;  // number of queue elements
 	static unsigned char station_qid[];  // this array stores the queue element index for each scheduled station
+	static unsigned char queued_bits[];  // bit set for each station that has a queue element assigned in station_qid
 	static unsigned char nprograms;  // number of programs
 	static LogStruct lastrun;
 	static time_os_t last_seq_stop_times[]; // the last stop time of a sequential station (for each sequential group respectively)
+	static bool master_dirty; // queue or master settings changed since the master states were computed
+#if !defined(ARDUINO)
+	static ProgramStruct programs[]; // resident copy of prog.dat, kept in sync by write-through
+	static time_os_t next_start[];   // next start time of each program (a recheck time if none was found)
+	static unsigned char next_found[];  // whether next_start is an actual start time
+	static unsigned char start_heap[];  // min-heap of program indices ordered by next_start
+	static unsigned char nstart_heap;
+
+	static void start_index_invalidate() { start_index_dirty = true; }
+	static unsigned char start_index_pop(time_os_t t, unsigned char *pids);
+	static time_os_t start_index_peek(time_os_t t);
+#endif
 
 	static void toggle_pause(ulong delay);
 	static void set_pause();
@@ -139,8 +186,10 @@ public:
 	static void clear_pause();
 
 	static void reset_runtime();
-	static RuntimeQueueStruct* enqueue(); // this returns a pointer to the next available slot in the queue
+	static unsigned char enqueue(uint16_t dur, unsigned char sid, unsigned char pid); // this appends an unscheduled element and returns its index, or 0xFF if the queue is full
 	static void dequeue(unsigned char qid);  // this removes an element from the queue
+	static void regroup_queue(); // re-file scheduled elements after station groups have changed
+	static void set_station_qid(unsigned char sid, unsigned char qid);
 
 	static void init();
 	static void eraseall();
@@ -155,6 +204,15 @@ public:
 private:
 	static void load_count();
 	static void save_count();
+#if !defined(ARDUINO)
+	static bool start_index_dirty;
+	static time_os_t start_index_time;
+	static uint16_t start_index_sunrise;
+	static uint16_t start_index_sunset;
+	static void start_index_update(time_os_t t);
+	static void start_heap_push(unsigned char pid);
+	static unsigned char start_heap_pop();
+#endif
 };
 
 #endif  // _PROGRAM_H
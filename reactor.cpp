@@ -0,0 +1,163 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Main loop event reactor
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(ARDUINO)
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include "reactor.h"
+#include "utils.h"
+
+int OSReactor::epfd = -1;
+int OSReactor::tfd = -1;
+int OSReactor::fds[NUM_REACTOR_SRCS] = {-1, -1, -1, -1};
+ino_t OSReactor::inos[NUM_REACTOR_SRCS];
+ulong OSReactor::nwakeups = 0;
+ulong OSReactor::nticks = 0;
+
+// the timer is identified by this tag, the sources by their index
+#define REACTOR_TAG_TIMER 0xFF
+
+/** Fire at every wall clock second, so the control cycle runs right after curr_time changes */
+void OSReactor::arm_timer() {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	struct itimerspec its;
+	its.it_value.tv_sec = now.tv_sec + 1;
+	its.it_value.tv_nsec = 0;
+	its.it_interval.tv_sec = 1;
+	its.it_interval.tv_nsec = 0;
+	// a clock change cancels the timer, so that it can be re-aligned
+	timerfd_settime(tfd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL);
+}
+
+bool OSReactor::init() {
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(epfd < 0) return false;
+	tfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(tfd < 0) {
+		close(epfd);
+		epfd = -1;
+		return false;
+	}
+	arm_timer();
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u32 = REACTOR_TAG_TIMER;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+	return true;
+}
+
+/** Watch a descriptor for a source, replacing the previous one; fd<0 stops watching
+ * A source that reconnected may get its old fd number back, while epoll has
+ * dropped the closed socket: the inode tells the two apart.
+ */
+void OSReactor::watch(unsigned char src, int fd, uint32_t events) {
+	if(epfd < 0 || src >= NUM_REACTOR_SRCS) return;
+	struct stat st;
+	if(fd >= 0 && fstat(fd, &st) < 0) fd = -1;
+	if(fds[src] == fd && (fd < 0 || inos[src] == st.st_ino)) return;
+	if(fds[src] >= 0) epoll_ctl(epfd, EPOLL_CTL_DEL, fds[src], NULL);
+	fds[src] = -1;
+	if(fd < 0) return;
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.u32 = src;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0 || (errno == EEXIST && epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == 0)) {
+		fds[src] = fd;
+		inos[src] = st.st_ino;
+	}
+}
+
+static uint16_t sockaddr_port(const struct sockaddr_storage &ss) {
+	if(ss.ss_family == AF_INET) return ntohs(((const struct sockaddr_in *)&ss)->sin_port);
+	if(ss.ss_family == AF_INET6) return ntohs(((const struct sockaddr_in6 *)&ss)->sin6_port);
+	return 0;
+}
+
+/** Find a TCP socket of this process: listening on port, or connected to a peer on port
+ * Used for the sockets that the web server library opens but does not expose.
+ * Returns -1 if there is none.
+ */
+int OSReactor::find_socket(uint16_t port, bool listening) {
+	DIR *dir = opendir("/proc/self/fd");
+	if(!dir) return -1;
+	int found = -1;
+	struct dirent *de;
+	while(found < 0 && (de = readdir(dir)) != NULL) {
+		if(de->d_name[0] < '0' || de->d_name[0] > '9') continue;
+		int fd = atoi(de->d_name);
+		if(fd == dirfd(dir)) continue;
+		struct stat st;
+		if(fstat(fd, &st) < 0 || !S_ISSOCK(st.st_mode)) continue;
+		int type = 0, acc = 0;
+		socklen_t len = sizeof(type);
+		if(getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0 || type != SOCK_STREAM) continue;
+		len = sizeof(acc);
+		if(getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &acc, &len) < 0 || (acc != 0) != listening) continue;
+		struct sockaddr_storage ss;
+		socklen_t sslen = sizeof(ss);
+		int ret = listening ? getsockname(fd, (struct sockaddr *)&ss, &sslen) : getpeername(fd, (struct sockaddr *)&ss, &sslen);
+		if(ret == 0 && sockaddr_port(ss) == port) found = fd;
+	}
+	closedir(dir);
+	return found;
+}
+
+/** Sleep until a source has work, the next second starts, or timeout_ms (-1: no limit) passes
+ * Returns the sources that woke it up, one bit per source.
+ */
+unsigned int OSReactor::wait(int timeout_ms) {
+	if(epfd < 0) {
+		// no epoll: fall back to polling
+		delay(1);
+		return 0;
+	}
+	struct epoll_event events[NUM_REACTOR_SRCS + 1];
+	int n = epoll_wait(epfd, events, NUM_REACTOR_SRCS + 1, timeout_ms);
+	nwakeups++;
+	unsigned int fired = 0;
+	for(int i = 0; i < n; i++) {
+		if(events[i].data.u32 != REACTOR_TAG_TIMER) {
+			fired |= 1 << events[i].data.u32;
+			continue;
+		}
+		uint64_t expirations;
+		if(read(tfd, &expirations, sizeof(expirations)) == (ssize_t)sizeof(expirations)) {
+			nticks++;
+		} else {
+			// ECANCELED: the clock was set
+			arm_timer();
+		}
+	}
+	return fired;
+}
+
+#endif
@@ -0,0 +1,70 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Main loop event reactor header file
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _REACTOR_H
+#define _REACTOR_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/types.h>
+#include "defines.h"
+
+/** Event sources; each holds at most one descriptor at a time */
+enum {
+	REACTOR_SRC_HTTP = 0,  // outbound http client (epoll descriptor)
+	REACTOR_SRC_MQTT,      // mosquitto socket, changes on reconnect
+	REACTOR_SRC_WEB,       // listening socket of the web server
+	REACTOR_SRC_CLOUD,     // OpenThings cloud connection, changes on reconnect
+	NUM_REACTOR_SRCS
+};
+
+#define REACTOR_POLL_MS        10    // upper bound on the sleep while a source cannot be watched
+#define REACTOR_WEB_LINGER_MS  1000  // polling after web activity, for the connection being served
+
+/** epoll based wait for the Linux main loop
+ * do_loop is run after every wake-up: on activity of a watched source,
+ * on the one second tick of a timerfd aligned to the wall clock second,
+ * or after the poll interval for work that has no descriptor to watch.
+ */
+class OSReactor {
+public:
+	static bool init();
+	static void watch(unsigned char src, int fd, uint32_t events);
+	static bool watching(unsigned char src) { return fds[src] >= 0; }
+	static unsigned int wait(int timeout_ms);
+	static int find_socket(uint16_t port, bool listening);
+
+	static ulong nwakeups;  // number of returns from wait
+	static ulong nticks;    // number of one second ticks
+private:
+	static int epfd;
+	static int tfd;
+	static int fds[];
+	static ino_t inos[];  // identify the socket behind each fd, as fd numbers are reused
+	static void arm_timer();
+};
+
+#endif
+
+#endif // _REACTOR_H
@@ -0,0 +1,172 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Water usage rollups
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(ARDUINO)
+
+#include <string.h>
+#include <time.h>
+#include "rollup.h"
+#include "utils.h"
+
+#define ROLLUP_ROW_SIZE  (sizeof(uint32_t) + MAX_NUM_STATIONS*sizeof(RollupEntry))
+
+bool OSRollup::ready = false;
+
+// rows of the query being answered
+static unsigned char rollup_rows[ROLLUP_MAX_ROWS * ROLLUP_ROW_SIZE];
+
+/** Month key of a (local) time: year*12 + month-1 */
+static uint32_t rollup_month(time_os_t t) {
+	struct tm tm;
+	time_t tt = t;
+	gmtime_r(&tt, &tm);
+	return (tm.tm_year+1900)*12 + tm.tm_mon;
+}
+
+/** Time of the first second of a month key */
+static time_os_t rollup_month_start(uint32_t key) {
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = key/12 - 1900;
+	tm.tm_mon = key%12;
+	tm.tm_mday = 1;
+	return timegm(&tm);
+}
+
+/** Check the file layout; a file of another layout is started over */
+bool OSRollup::open() {
+	if(ready) return true;
+	RollupHeader h;
+	file_read_block(ROLLUP_FILENAME, &h, 0, sizeof(h));
+	if(h.magic != ROLLUP_MAGIC || h.version != ROLLUP_VERSION || h.nstations != MAX_NUM_STATIONS ||
+	   h.ndays != ROLLUP_NUM_DAYS || h.nmonths != ROLLUP_NUM_MONTHS) {
+		remove_file(ROLLUP_FILENAME);
+		h.magic = ROLLUP_MAGIC;
+		h.version = ROLLUP_VERSION;
+		h.nstations = MAX_NUM_STATIONS;
+		h.ndays = ROLLUP_NUM_DAYS;
+		h.nmonths = ROLLUP_NUM_MONTHS;
+		// rows beyond the end of the file read back as zeros, i.e. as unused
+		file_write_block(ROLLUP_FILENAME, &h, 0, sizeof(h));
+	}
+	ready = true;
+	return true;
+}
+
+ulong OSRollup::row_pos(bool monthly, uint32_t key) {
+	ulong row = monthly ? ROLLUP_NUM_DAYS + key % ROLLUP_NUM_MONTHS : key % ROLLUP_NUM_DAYS;
+	return sizeof(RollupHeader) + row * ROLLUP_ROW_SIZE;
+}
+
+void OSRollup::add_to_row(bool monthly, uint32_t key, unsigned char sid, uint32_t seconds, uint32_t volume) {
+	ulong pos = row_pos(monthly, key);
+	uint32_t row_key;
+	file_read_block(ROLLUP_FILENAME, &row_key, pos, sizeof(row_key));
+	if(row_key != key) {
+		// the row last held an older period: start it over
+		memset(rollup_rows, 0, ROLLUP_ROW_SIZE);
+		memcpy(rollup_rows, &key, sizeof(key));
+		file_write_block(ROLLUP_FILENAME, rollup_rows, pos, ROLLUP_ROW_SIZE);
+	}
+	RollupEntry e;
+	pos += sizeof(uint32_t) + sid*sizeof(RollupEntry);
+	file_read_block(ROLLUP_FILENAME, &e, pos, sizeof(e));
+	e.seconds += seconds;
+	e.volume += volume;
+	if(e.runs < 0xFFFF) e.runs++;
+	file_write_block(ROLLUP_FILENAME, &e, pos, sizeof(e));
+}
+
+/** Count a station run that ended at (local) time t */
+void OSRollup::add(unsigned char sid, time_os_t t, uint32_t seconds, uint32_t volume) {
+	if(sid >= MAX_NUM_STATIONS || !open()) return;
+	add_to_row(false, t/86400, sid, seconds, volume);
+	add_to_row(true, rollup_month(t), sid, seconds, volume);
+}
+
+/** Totals per station (MAX_NUM_STATIONS entries) of the span containing t
+ * start and end receive the first and last second of the span.
+ * Fails if the span is not within the rows kept as of (local) time now,
+ * i.e. if it starts before them or if t is in a later period than now.
+ */
+bool OSRollup::query(unsigned char span, time_os_t t, time_os_t now, RollupEntry *totals, time_os_t *start, time_os_t *end) {
+	if(!open()) return false;
+	bool monthly = (span != ROLLUP_SPAN_WEEK);
+	uint32_t first, count, nrows;
+	if(span == ROLLUP_SPAN_WEEK) {
+		if(t/86400 < 6) return false;
+		first = t/86400 - 6;
+		count = 7;
+		nrows = ROLLUP_NUM_DAYS;
+		*start = (time_os_t)first*86400;
+		*end = (time_os_t)(first+count)*86400 - 1;
+	} else if(span == ROLLUP_SPAN_MONTH) {
+		first = rollup_month(t);
+		count = 1;
+		nrows = ROLLUP_NUM_MONTHS;
+		*start = rollup_month_start(first);
+		*end = rollup_month_start(first+1) - 1;
+	} else if(span == ROLLUP_SPAN_YEAR) {
+		first = rollup_month(t)/12*12;
+		count = 12;
+		nrows = ROLLUP_NUM_MONTHS;
+		*start = rollup_month_start(first);
+		*end = rollup_month_start(first+12) - 1;
+	} else {
+		return false;
+	}
+	// the oldest row kept is nrows-1 periods before the current one
+	uint32_t key = monthly ? rollup_month(t) : t/86400;
+	uint32_t last = monthly ? rollup_month(now) : now/86400;
+	if(key > last || first + nrows <= last) return false;
+
+	// the rows of a span are consecutive in the ring: one read, or two if it wraps
+	uint32_t idx = first % nrows;
+	uint32_t n1 = (idx + count <= nrows) ? count : nrows - idx;
+	file_read_block(ROLLUP_FILENAME, rollup_rows, row_pos(monthly, first), n1*ROLLUP_ROW_SIZE);
+	if(n1 < count) {
+		file_read_block(ROLLUP_FILENAME, rollup_rows + n1*ROLLUP_ROW_SIZE, row_pos(monthly, first+n1), (count-n1)*ROLLUP_ROW_SIZE);
+	}
+
+	memset(totals, 0, MAX_NUM_STATIONS*sizeof(RollupEntry));
+	for(uint32_t i=0; i<count; i++) {
+		const unsigned char *row = rollup_rows + i*ROLLUP_ROW_SIZE;
+		uint32_t key;
+		memcpy(&key, row, sizeof(key));
+		if(key != first+i) continue;  // nothing recorded in this period
+		const RollupEntry *e = (const RollupEntry*)(row + sizeof(uint32_t));
+		for(unsigned char sid=0; sid<MAX_NUM_STATIONS; sid++) {
+			totals[sid].seconds += e[sid].seconds;
+			totals[sid].volume += e[sid].volume;
+			uint32_t runs = totals[sid].runs + e[sid].runs;
+			totals[sid].runs = (runs < 0xFFFF) ? runs : 0xFFFF;
+		}
+	}
+	return true;
+}
+
+void OSRollup::clear() {
+	remove_file(ROLLUP_FILENAME);
+	ready = false;
+}
+
+#endif
@@ -0,0 +1,85 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Water usage rollups header file
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ROLLUP_H
+#define _ROLLUP_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include "defines.h"
+#include "types.h"
+
+#define ROLLUP_FILENAME    "rollup.dat"
+#define ROLLUP_MAGIC       0x5552534F  // "OSRU"
+#define ROLLUP_VERSION     1
+#define ROLLUP_NUM_DAYS    62          // daily rows kept (a week query needs 7)
+#define ROLLUP_NUM_MONTHS  25          // monthly rows kept (a year query needs 12)
+#define ROLLUP_MAX_ROWS    12          // rows read by the largest query
+
+/** Totals of one station over a day or a month */
+struct RollupEntry {
+	uint32_t seconds;  // run time
+	uint32_t volume;   // flow volume in 1/100 units (pulses x pulse rate), 0 without a flow sensor;
+	                   // split evenly among the stations running when a run ends
+	uint16_t runs;
+	uint16_t reserved;
+};
+
+/** File header; the rows follow: ROLLUP_NUM_DAYS daily rows, then ROLLUP_NUM_MONTHS monthly rows.
+ * A row is a uint32_t key (day: epoch time / 86400, month: year*12 + month-1)
+ * followed by one RollupEntry per station. Rows are reused in a ring, so a
+ * row whose key does not match the period asked for holds no data for it.
+ */
+struct RollupHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t nstations;
+	uint16_t ndays;
+	uint16_t nmonths;
+};
+
+enum {
+	ROLLUP_SPAN_WEEK = 0,  // the 7 days ending on the given day
+	ROLLUP_SPAN_MONTH,     // the calendar month of the given day
+	ROLLUP_SPAN_YEAR,      // the calendar year of the given day
+};
+
+/** Per-station water usage, kept up to date as station runs are logged
+ * Each run updates its entry in the row of its day and of its month, so a
+ * week, month or year total is a single read of at most 12 rows.
+ */
+class OSRollup {
+public:
+	static void add(unsigned char sid, time_os_t t, uint32_t seconds, uint32_t volume);
+	static bool query(unsigned char span, time_os_t t, time_os_t now, RollupEntry *totals, time_os_t *start, time_os_t *end);
+	static void clear();
+private:
+	static bool ready;
+	static bool open();
+	static ulong row_pos(bool monthly, uint32_t key);
+	static void add_to_row(bool monthly, uint32_t key, unsigned char sid, uint32_t seconds, uint32_t volume);
+};
+
+#endif
+
+#endif // _ROLLUP_H
@@ -0,0 +1,292 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Scheduler simulation
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#if defined(SIMULATION)
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "OpenSprinkler.h"
+#include "program.h"
+#include "main.h"
+#include "sim.h"
+
+extern OpenSprinkler os;
+extern ProgramData pd;
+void do_loop();
+
+time_os_t OSSim::clock = 0;
+unsigned char OSSim::sensor[2] = {0, 0};
+SimEvent *OSSim::events = NULL;
+uint16_t OSSim::nevents = 0;
+time_os_t OSSim::begin_time = 0;
+time_os_t OSSim::end_time = 0;
+ulong OSSim::nloops = 0;
+ulong OSSim::nvalves = 0;
+ulong OSSim::nlogs = 0;
+
+/** Parse "YYYY-MM-DD HH:MM[:SS]"; returns the number of characters used, 0 on error */
+static int sim_parse_time(const char *s, time_os_t *t) {
+	struct tm tm;
+	int n = 0;
+	memset(&tm, 0, sizeof(tm));
+	if(sscanf(s, "%d-%d-%d %d:%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &n) < 5) return 0;
+	if(s[n] == ':') {
+		int m = 0;
+		if(sscanf(s+n+1, "%d%n", &tm.tm_sec, &m) < 1) return 0;
+		n += m+1;
+	}
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	*t = timegm(&tm);
+	return n;
+}
+
+/** Load a scenario; begin and end are taken out, the other commands are kept in time order */
+bool OSSim::load(const char *path) {
+	FILE *fp = fopen(path, "r");
+	if(!fp) {
+		printf("sim: cannot open %s\n", path);
+		return false;
+	}
+	events = (SimEvent*)malloc(sizeof(SimEvent) * SIM_MAX_EVENTS);
+	nevents = 0;
+	begin_time = end_time = 0;
+	char line[SIM_MAX_ARG_LEN + 64];
+	int lineno = 0;
+	bool ok = (events != NULL);
+	while(ok && fgets(line, sizeof(line), fp)) {
+		lineno++;
+		char *p = line;
+		while(*p == ' ' || *p == '\t') p++;
+		if(*p == '#' || *p == '\r' || *p == '\n' || *p == 0) continue;
+		SimEvent e;
+		int n = sim_parse_time(p, &e.t);
+		int m = 0;
+		if(!n || sscanf(p+n, " %7s %n", e.cmd, &m) < 1) {
+			printf("sim: %s:%d: expected <date> <time> <command>\n", path, lineno);
+			ok = false;
+			break;
+		}
+		p += n + m;
+		p[strcspn(p, "#\r\n")] = 0;
+		strncpy(e.arg, p, SIM_MAX_ARG_LEN - 1);
+		e.arg[SIM_MAX_ARG_LEN - 1] = 0;
+
+		if(strcmp(e.cmd, "begin") == 0) {
+			begin_time = e.t;
+		} else if(strcmp(e.cmd, "end") == 0) {
+			end_time = e.t;
+		} else if(nevents && e.t < events[nevents-1].t) {
+			printf("sim: %s:%d: events must be in time order\n", path, lineno);
+			ok = false;
+		} else if(nevents == SIM_MAX_EVENTS) {
+			printf("sim: %s:%d: too many events\n", path, lineno);
+			ok = false;
+		} else {
+			events[nevents++] = e;
+		}
+	}
+	fclose(fp);
+	if(ok && (!begin_time || end_time <= begin_time)) {
+		printf("sim: %s: needs a begin and a later end\n", path);
+		ok = false;
+	}
+	// the controller starts at begin; the time zone is applied once the options are loaded
+	clock = begin_time;
+	return ok;
+}
+
+/** Pin level of a scripted sensor, as detect_binarysensor_status expects it */
+unsigned char OSSim::sensor_input(unsigned char i) {
+	// the firmware treats an input as active when it differs from the sensor option
+	unsigned char option = os.iopts[i ? IOPT_SENSOR2_OPTION : IOPT_SENSOR1_OPTION];
+	return sensor[i] ? !option : option;
+}
+
+const char* OSSim::timestr(time_os_t local) {
+	static char buf[24];
+	struct tm tm;
+	time_t t = local;
+	gmtime_r(&t, &tm);
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+	return buf;
+}
+
+void OSSim::log_record(const BinLogRecord &rec) {
+	char line[TMP_BUFFER_SIZE];
+	int len = OSBinLog::format(rec, line, sizeof(line));
+	while(len > 0 && (line[len-1] == '\r' || line[len-1] == '\n')) line[--len] = 0;
+	printf("%s log %s\n", timestr(rec.time), line);
+	nlogs++;
+}
+
+/** Parse comma-separated durations (seconds) into one value per station */
+static void sim_parse_durations(const char *s, uint16_t *durations) {
+	for(unsigned char sid=0; sid<MAX_NUM_STATIONS && *s; sid++) {
+		char *end;
+		durations[sid] = (uint16_t)strtoul(s, &end, 10);
+		if(*end != ',') break;
+		s = end+1;
+	}
+}
+
+void OSSim::apply(const SimEvent &e) {
+	time_os_t curr_time = os.now_tz();
+	if(strcmp(e.cmd, "prog") == 0) {
+		// weekly program with one fixed start time, using weather adjustment
+		ProgramStruct prog;
+		char days[8], durs[SIM_MAX_ARG_LEN];
+		int hh, mm;
+		memset((void*)&prog, 0, sizeof(prog));
+		if(sscanf(e.arg, "%31s %7s %d:%d %199s", prog.name, days, &hh, &mm, durs) < 5) {
+			printf("sim: %s: bad prog arguments\n", timestr(e.t));
+			return;
+		}
+		prog.enabled = 1;
+		prog.use_weather = 1;
+		prog.type = PROGRAM_TYPE_WEEKLY;
+		prog.starttime_type = 1;
+		for(unsigned char i=0; i<7 && days[i]; i++) {
+			if(days[i] == '1') prog.days[0] |= (1<<i);
+		}
+		prog.starttimes[0] = hh*60 + mm;
+		for(unsigned char i=1; i<MAX_NUM_STARTTIMES; i++) prog.starttimes[i] = -1;
+		prog.daterange[0] = MIN_ENCODED_DATE;
+		prog.daterange[1] = MAX_ENCODED_DATE;
+		sim_parse_durations(durs, prog.durations);
+		if(!pd.add(&prog)) printf("sim: %s: program table is full\n", timestr(e.t));
+	} else if(strcmp(e.cmd, "run") == 0) {
+		// same as a run-once program from the web interface
+		uint16_t durations[MAX_NUM_STATIONS];
+		memset(durations, 0, sizeof(durations));
+		sim_parse_durations(e.arg, durations);
+		bool match_found = false;
+		for(unsigned char sid=0; sid<os.nstations; sid++) {
+			if(durations[sid] && !(os.attrib_dis[sid>>3]&(1<<(sid&0x07)))) {
+				if(pd.enqueue(durations[sid], sid, 254) != 0xFF) match_found = true;
+			}
+		}
+		if(match_found) schedule_all_stations(curr_time);
+	} else if(strcmp(e.cmd, "stop") == 0) {
+		reset_all_stations();
+	} else if(strcmp(e.cmd, "wl") == 0) {
+		// same as a weather service update of the watering level
+		int v = atoi(e.arg);
+		if(v>=0 && v<=250 && v!=os.iopts[IOPT_WATER_PERCENTAGE]) {
+			os.iopts[IOPT_WATER_PERCENTAGE] = v;
+			os.iopts_save();
+		}
+		write_log(LOGDATA_WATERLEVEL, curr_time);
+	} else if(strcmp(e.cmd, "rd") == 0) {
+		int rd = atoi(e.arg);
+		if(rd > 0) {
+			os.nvdata.rd_stop_time = curr_time + (unsigned long)rd * 3600;
+			os.raindelay_start();
+		} else {
+			os.raindelay_stop();
+		}
+	} else if(strcmp(e.cmd, "sn1") == 0 || strcmp(e.cmd, "sn2") == 0) {
+		sensor[e.cmd[2]-'1'] = atoi(e.arg) ? 1 : 0;
+	} else if(strcmp(e.cmd, "opt") == 0) {
+		char name[8];
+		int v;
+		if(sscanf(e.arg, "%7s %d", name, &v) < 2) return;
+		char tbuf[6];
+		for(unsigned char oid=0; oid<NUM_IOPTS; oid++) {
+			strncpy_P0(tbuf, iopt_json_names+oid*5, 5);
+			if(strcmp(tbuf, name) == 0) {
+				os.iopts[oid] = v;
+				os.iopts_save();
+				os.populate_master();
+				return;
+			}
+		}
+		printf("sim: %s: unknown option %s\n", timestr(e.t), name);
+	} else {
+		printf("sim: %s: unknown command %s\n", timestr(e.t), e.cmd);
+	}
+}
+
+/** Nothing can happen before the next event, program start, rain delay end or day change */
+bool OSSim::idle() {
+	if(os.status.program_busy || pd.nqueue || os.status.pause_state) return false;
+	// a sensor change is still being debounced
+	if(os.status.sensor1 != os.status.sensor1_active) return false;
+	if(os.status.sensor2 != os.status.sensor2_active) return false;
+	return true;
+}
+
+int OSSim::run() {
+	struct timespec w0, w1;
+	clock_gettime(CLOCK_MONOTONIC, &w0);
+
+	// scenario times are local: align the clock with the time zone loaded by do_setup
+	clock = begin_time - (os.now_tz() - clock);
+
+	unsigned char bits[MAX_NUM_BOARDS];
+	memcpy(bits, os.station_bits, sizeof(bits));
+	uint16_t ev = 0;
+	for(;;) {
+		time_os_t local = os.now_tz();
+		time_os_t offset = local - clock;
+		if(local > end_time) break;
+		while(ev < nevents && events[ev].t <= local) apply(events[ev++]);
+
+		do_loop();
+		nloops++;
+
+		// valve timeline
+		for(unsigned char bid=0; bid<os.nboards; bid++) {
+			unsigned char diff = bits[bid] ^ os.station_bits[bid];
+			for(unsigned char s=0; diff; s++, diff>>=1) {
+				if(!(diff & 1)) continue;
+				unsigned char on = (os.station_bits[bid]>>s) & 1;
+				printf("%s s%02d %s\n", timestr(local), bid*8+s+1, on ? "on" : "off");
+				nvalves++;
+			}
+			bits[bid] = os.station_bits[bid];
+		}
+
+		time_os_t next = local + 1;
+		if(idle()) {
+			time_os_t wake = end_time + 1;
+			if(ev < nevents && events[ev].t < wake) wake = events[ev].t;
+			time_os_t t = pd.start_index_peek(local);
+			if(t && t < wake) wake = t;
+			if(os.nvdata.rd_stop_time > (ulong)local && (time_os_t)os.nvdata.rd_stop_time < wake) wake = os.nvdata.rd_stop_time;
+			t = (local/86400 + 1) * 86400;  // daily work, e.g. monthly adjustment
+			if(t < wake) wake = t;
+			if(wake > next) next = wake;
+		}
+		clock = next - offset;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &w1);
+	ulong ms = (w1.tv_sec - w0.tv_sec) * 1000 + (w1.tv_nsec - w0.tv_nsec) / 1000000;
+	printf("# simulated %lu days: %lu valve changes, %lu log records, %lu loop iterations in %lu ms\n",
+		(ulong)((end_time - begin_time) / 86400), nvalves, nlogs, nloops, ms);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,85 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Scheduler simulation header file
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SIM_H
+#define _SIM_H
+
+#if defined(SIMULATION)
+
+#include "types.h"
+#include "binlog.h"
+
+#define SIM_MAX_EVENTS    4096
+#define SIM_MAX_ARG_LEN   200
+
+/** One scenario line: at controller local time t, run command cmd with arg */
+struct SimEvent {
+	time_os_t t;
+	char cmd[8];
+	char arg[SIM_MAX_ARG_LEN];
+};
+
+/** Scheduler simulation (build with -DDEMO -DSIMULATION, see build.sh sim)
+ * The firmware runs against a virtual clock and in-memory data files
+ * (see utils.cpp), with the network disabled. A scenario file drives it:
+ *
+ *   # date     time      command  arguments (controller local time)
+ *   2024-01-01 00:00     begin
+ *   2024-01-01 00:00     prog     lawn 1010100 06:00 600,600,0,300
+ *   2024-03-02 05:00     rd       24
+ *   2024-05-10 12:00     sn1      1
+ *   2024-06-01 00:00     wl       140
+ *   2024-12-31 23:59:59  end
+ *
+ * Commands: begin, end, prog <name> <days Mon..Sun> <HH:MM> <durations>,
+ * run <durations>, stop, wl <percent>, rd <hours>, sn1|sn2 <0|1>,
+ * opt <json name> <value>. Durations are comma-separated seconds per station.
+ *
+ * The valve timeline and the log records are printed as they happen.
+ * While nothing is queued, the clock jumps to the next event, program
+ * start, rain delay end or midnight instead of ticking every second.
+ */
+class OSSim {
+public:
+	static time_os_t clock;          // virtual UTC time returned to the firmware
+	static unsigned char sensor[2];  // scripted state of sensor 1 and 2 (1: active)
+
+	static bool load(const char *path);
+	static int run();
+	static unsigned char sensor_input(unsigned char i);
+	static void log_record(const BinLogRecord &rec);
+private:
+	static SimEvent *events;
+	static uint16_t nevents;
+	static time_os_t begin_time;
+	static time_os_t end_time;
+	static ulong nloops;
+	static ulong nvalves;
+	static ulong nlogs;
+	static void apply(const SimEvent &e);
+	static bool idle();
+	static const char* timestr(time_os_t local);
+};
+
+#endif
+
+#endif // _SIM_H
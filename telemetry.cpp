@@ -0,0 +1,168 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Valve telemetry (InfluxDB line protocol)
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(ARDUINO)
+
+#include "OpenSprinkler.h"
+#include "types.h"
+#include "telemetry.h"
+#include "httpclient.h"
+#include "ArduinoJson.hpp"
+
+extern OpenSprinkler os;
+extern char tmp_buffer[];
+
+bool OSTelemetry::_enabled = false;
+char OSTelemetry::_host[TELEMETRY_MAX_HOST_LEN + 1];
+uint16_t OSTelemetry::_port = 8086;
+char OSTelemetry::_db[TELEMETRY_MAX_DB_LEN + 1];
+TelemetryEvent OSTelemetry::ring[TELEMETRY_RING_SIZE];
+uint16_t OSTelemetry::head = 0;
+uint16_t OSTelemetry::count = 0;
+uint16_t OSTelemetry::inflight = 0;
+int OSTelemetry::write_status = 0;
+time_os_t OSTelemetry::last_flush = 0;
+ulong OSTelemetry::nrecorded = 0;
+ulong OSTelemetry::nsent = 0;
+ulong OSTelemetry::ndropped = 0;
+
+static char telemetry_buffer[ETHER_BUFFER_SIZE];
+
+/** Load telemetry configuration from SOPT_INFLUX_OPTS */
+void OSTelemetry::init() {
+	_enabled = false;
+	_host[0] = 0;
+	_port = 8086;
+	strcpy(_db, "ospi");
+
+	// JSON configuration settings in the form of {"en":0|1,"host":"server_name|IP address","port":8086,"db":"ospi"}
+	char *config = tmp_buffer + 1;
+	os.sopt_load(SOPT_INFLUX_OPTS, config);
+	if(*config != 0) {
+		// Add the wrapping curly braces to the string
+		config = tmp_buffer;
+		config[0] = '{';
+		int len = strlen(config);
+		config[len] = '}';
+		config[len+1] = 0;
+
+		ArduinoJson::JsonDocument doc;
+		ArduinoJson::DeserializationError error = ArduinoJson::deserializeJson(doc, config);
+		if (error) {
+			DEBUG_PRINT(F("telemetry: deserializeJson() failed: "));
+			DEBUG_PRINTLN(error.c_str());
+		} else {
+			_enabled = (bool)doc["en"];
+			const char *host_val = doc["host"];
+			if(host_val) strncpy(_host, host_val, TELEMETRY_MAX_HOST_LEN);
+			if(doc["port"]) _port = doc["port"];
+			const char *db_val = doc["db"];
+			if(db_val && db_val[0]) strncpy(_db, db_val, TELEMETRY_MAX_DB_LEN);
+		}
+		_host[TELEMETRY_MAX_HOST_LEN] = 0;
+		_db[TELEMETRY_MAX_DB_LEN] = 0;
+	}
+	if(_host[0]==0) _enabled = false;
+	if(!_enabled) {
+		// discard anything buffered under the old configuration
+		head = count = 0;
+	}
+}
+
+/** Record a valve change; never blocks */
+void OSTelemetry::record_valve(unsigned char sid, bool on) {
+	if(!_enabled) return;
+	if(count==TELEMETRY_RING_SIZE) {
+		count--; // drop the oldest event
+		ndropped++;
+	}
+	TelemetryEvent &e = ring[head];
+	e.t = (uint32_t)time(NULL);
+	e.sid = sid;
+	e.on = on;
+	head = (head+1)%TELEMETRY_RING_SIZE;
+	count++;
+	nrecorded++;
+}
+
+/** Write buffered events periodically, or sooner when the ring is half full */
+void OSTelemetry::loop(time_os_t curr_time) {
+	if(!_enabled || !count || inflight) return;
+	if(curr_time < last_flush + TELEMETRY_FLUSH_INTERVAL && count < TELEMETRY_RING_SIZE/2) return;
+	last_flush = curr_time;
+	flush();
+}
+
+/** Send the oldest buffered events as one line protocol batch */
+void OSTelemetry::flush() {
+	// leave room for the request header
+	const int body_max = ETHER_BUFFER_SIZE - 256;
+	char *body = telemetry_buffer + 256;
+	int len = 0;
+	uint16_t n = 0;
+	uint16_t tail = (head + TELEMETRY_RING_SIZE - count) % TELEMETRY_RING_SIZE;
+	while(n<count) {
+		const TelemetryEvent &e = ring[(tail+n)%TELEMETRY_RING_SIZE];
+		char line[80];
+		int l = snprintf(line, sizeof(line), "valve%02d value=%d %lu\nvalves value=%d %lu\n",
+			e.sid+1, e.on, (ulong)e.t, e.on?e.sid+1:0, (ulong)e.t);
+		if(len+l >= body_max) break;
+		memcpy(body+len, line, l);
+		len += l;
+		n++;
+	}
+	body[len] = 0;
+
+	int hlen = snprintf(telemetry_buffer, 256,
+		"POST /write?db=%s&precision=s HTTP/1.0\r\n"
+		"Host: %s\r\n"
+		"Content-Type: text/plain\r\n"
+		"Content-Length: %d\r\n"
+		"\r\n", _db, _host, len);
+	memmove(telemetry_buffer+hlen, body, len+1);
+
+	HTTPRequest rqt = {_host, _port, telemetry_buffer, false, 5000, write_response, write_done};
+	// the request text is copied on submit, so the events can leave the ring now;
+	// inflight is set first because write_done may be called from within submit
+	count -= n;
+	inflight = n;
+	write_status = 0;
+	if(OSHttpClient::submit(rqt)!=HTTP_RQT_SUCCESS) {
+		ndropped += n;
+		inflight = 0;
+	}
+}
+
+/** Take the status code from the response line, e.g. "HTTP/1.1 204 No Content" */
+void OSTelemetry::write_response(char *response) {
+	int code;
+	if(sscanf(response, "HTTP/%*s %d", &code)==1) write_status = code;
+}
+
+void OSTelemetry::write_done(int8_t result) {
+	// InfluxDB answers a stored write with 204; anything other than 2xx means the batch was refused
+	if(result==HTTP_RQT_SUCCESS && write_status>=200 && write_status<300) nsent += inflight;
+	else ndropped += inflight;
+	inflight = 0;
+}
+
+#endif
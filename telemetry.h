@@ -0,0 +1,78 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Valve telemetry (InfluxDB line protocol) header file
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TELEMETRY_H
+#define _TELEMETRY_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include "defines.h"
+#include "types.h"
+
+#define TELEMETRY_RING_SIZE      256  // number of valve events buffered in memory
+#define TELEMETRY_FLUSH_INTERVAL 10   // seconds between batched writes
+#define TELEMETRY_MAX_HOST_LEN   64
+#define TELEMETRY_MAX_DB_LEN     32
+
+/** Valve event, recorded on every actual station bit change */
+struct TelemetryEvent {
+	uint32_t t;       // UTC time stamp
+	unsigned char sid;
+	unsigned char on;
+};
+
+/** Batched valve telemetry
+ * Events are kept in a fixed-size ring buffer and written in batches,
+ * as InfluxDB line protocol, through the asynchronous HTTP client.
+ * When the ring is full the oldest event is dropped.
+ * Configuration is stored in SOPT_INFLUX_OPTS as
+ * "en":0|1,"host":"server","port":8086,"db":"ospi"
+ */
+class OSTelemetry {
+public:
+	static void init();
+	static bool enabled() { return _enabled; }
+	static void record_valve(unsigned char sid, bool on);
+	static void loop(time_os_t curr_time);
+
+	static ulong nrecorded;  // events recorded
+	static ulong nsent;      // events written successfully (2xx response)
+	static ulong ndropped;   // events lost due to a full ring, a failed write or an error response
+private:
+	static bool _enabled;
+	static char _host[];
+	static uint16_t _port;
+	static char _db[];
+	static TelemetryEvent ring[];
+	static uint16_t head, count;
+	static uint16_t inflight;   // number of events in the batch being written
+	static int write_status;    // HTTP status code of the write response, 0 if none
+	static time_os_t last_flush;
+	static void flush();
+	static void write_response(char *response);
+	static void write_done(int8_t result);
+};
+
+#endif
+
+#endif // _TELEMETRY_H
@@ -0,0 +1,499 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Unit tests
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#if defined(UNITTEST)
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "OpenSprinkler.h"
+#include "program.h"
+#include "main.h"
+#include "binlog.h"
+#include "opensprinkler_server.h"
+#include "rollup.h"
+#include "test.h"
+
+extern OpenSprinkler os;
+extern ProgramData pd;
+extern char tmp_buffer[];
+extern char LOG_PREFIX[];
+boolean credentials_ok(const char *pw, const char *tk, boolean token_ok);
+
+char OSTest::data_dir[] = "/tmp/os-test-XXXXXX";
+
+#define TEST_PASSWORD "a6d82bced638de3def1e9bbb4983225c"
+
+/** A session token opens the read and control URLs, but not /sp
+ * server_change_password (like /co, and /cv with rbt or update) passes
+ * token_ok=false, so /sp?tk=... is answered with HTML_UNAUTHORIZED.
+ */
+static bool test_session_token_sp() {
+	os.sopt_save(SOPT_PASSWORD, TEST_PASSWORD);
+	char tk[SESSION_TOKEN_LEN+1];
+	TEST_CHECK(os.session_start(tk));
+	TEST_CHECK(credentials_ok(NULL, tk, true));            // e.g. /jc?tk=...
+	TEST_CHECK(!credentials_ok(NULL, tk, false));          // /sp?tk=...
+	TEST_CHECK(!credentials_ok("wrong", tk, false));       // /sp?pw=wrong&tk=...
+	TEST_CHECK(credentials_ok(TEST_PASSWORD, NULL, false)); // /sp?pw=...
+	TEST_CHECK(!credentials_ok(NULL, "0123456789abcdef0123456789abcdef", true));
+	// changing the password ends every session
+	os.sopt_save(SOPT_PASSWORD, "changed");
+	TEST_CHECK(!credentials_ok(NULL, tk, true));
+	os.sopt_save(SOPT_PASSWORD, TEST_PASSWORD);
+	return true;
+}
+
+#if defined(GPIOMEM) && defined(OSPI)
+/** apply_all_station_bits on the simulated 74HC595 chain latches every board's bits
+ * Only in the OSPi /dev/gpiomem build (make test-gpiomem).
+ */
+static bool test_gpiomem_shift_out() {
+	TEST_CHECK(gpiomem_available());
+	os.status.enabled = 1;
+	srand(1);
+	for(int round=0; round<8; round++) {
+		for(unsigned char bid=0; bid<MAX_NUM_BOARDS; bid++) os.station_bits[bid] = rand() & 0xFF;
+		ulong shiftouts = os.nshiftouts;
+		os.apply_all_station_bits();
+		TEST_CHECK(os.nshiftouts == shiftouts+1);
+		const unsigned char *out = gpiomem_sim_outputs();
+		TEST_CHECK(out != NULL);
+		TEST_CHECK(memcmp(out, os.station_bits, MAX_NUM_BOARDS) == 0);
+	}
+	// nothing changed: no shift-out
+	ulong skips = os.nshiftskips;
+	os.apply_all_station_bits();
+	TEST_CHECK(os.nshiftskips == skips+1);
+	// a disabled controller latches all zones off
+	os.status.enabled = 0;
+	os.apply_all_station_bits();
+	for(unsigned char bid=0; bid<MAX_NUM_BOARDS; bid++) TEST_CHECK(gpiomem_sim_outputs()[bid] == 0);
+	os.clear_all_station_bits();
+	os.status.enabled = 1;
+	os.apply_all_station_bits();
+	return true;
+}
+#endif
+
+#define TEST_QUEUE_SEQUENCES  200  // random operation sequences
+#define TEST_QUEUE_OPS        300  // operations per sequence
+#define TEST_QUEUE_STATIONS    24  // stations drawn from
+
+/** The runtime queue as it was before the group lists: every walk goes by index
+ * Reference for the list-based queue; each method is the old code of the
+ * firmware function of the same name, on the same state.
+ */
+struct FlatQueue {
+	time_os_t st[RUNTIME_QUEUE_SIZE];
+	time_os_t deque_time[RUNTIME_QUEUE_SIZE];
+	uint16_t dur[RUNTIME_QUEUE_SIZE];
+	unsigned char sid[RUNTIME_QUEUE_SIZE];
+	unsigned char pid[RUNTIME_QUEUE_SIZE];
+	unsigned char n;
+	time_os_t last_seq_stop_times[NUM_SEQ_GROUPS];
+
+	void reset() {
+		n = 0;
+		memset(last_seq_stop_times, 0, sizeof(last_seq_stop_times));
+	}
+
+	void set(unsigned char qid, uint16_t _dur, unsigned char _sid, unsigned char _pid) {
+		st[qid] = 0;
+		deque_time[qid] = 0;
+		dur[qid] = _dur;
+		sid[qid] = _sid;
+		pid[qid] = _pid;
+	}
+
+	unsigned char enqueue(uint16_t _dur, unsigned char _sid, unsigned char _pid) {
+		if(n >= RUNTIME_QUEUE_SIZE) return 0xFF;
+		set(n, _dur, _sid, _pid);
+		return n++;
+	}
+
+	void dequeue(unsigned char qid) {
+		if(qid >= n) return;
+		if(qid < n-1) {
+			st[qid] = st[n-1];
+			deque_time[qid] = deque_time[n-1];
+			dur[qid] = dur[n-1];
+			sid[qid] = sid[n-1];
+			pid[qid] = pid[n-1];
+		}
+		n--;
+	}
+
+	// no master stations: the dequeue time is the end time
+	void schedule_all_stations(time_os_t curr_time) {
+		ulong con_start_time = curr_time + 1;
+		if(os.status.pause_state) con_start_time += os.pause_timer;
+		int16_t station_delay = water_time_decode_signed(os.iopts[IOPT_STATION_DELAY_TIME]);
+		ulong seq_start_times[NUM_SEQ_GROUPS];
+		for(unsigned char i=0; i<NUM_SEQ_GROUPS; i++) {
+			seq_start_times[i] = con_start_time;
+			if(last_seq_stop_times[i] > curr_time) seq_start_times[i] = last_seq_stop_times[i] + station_delay;
+		}
+		for(unsigned char qid=0; qid<n; qid++) {
+			if(st[qid]) continue;
+			if(!dur[qid]) continue;
+			unsigned char gid = os.get_station_gid(sid[qid]);
+			if(os.is_sequential_station(sid[qid])) {
+				st[qid] = seq_start_times[gid];
+				seq_start_times[gid] += dur[qid];
+				seq_start_times[gid] += station_delay;
+			} else {
+				st[qid] = con_start_time;
+				con_start_time++;
+			}
+			deque_time[qid] = st[qid] + dur[qid];
+		}
+	}
+
+	void handle_shift_remaining_stations(unsigned char qid, unsigned char gid, time_os_t curr_time) {
+		time_os_t q_end_time = st[qid] + dur[qid];
+		ulong remainder = 0;
+		if(q_end_time > curr_time) {
+			remainder = (st[qid] < curr_time) ? q_end_time - curr_time : dur[qid];
+			for(unsigned char i=0; i<n; i++) {
+				if(st[i] < q_end_time) continue;
+				if(i == qid || os.get_station_gid(sid[i]) != gid || !os.is_sequential_station(sid[i])) continue;
+				st[i] -= remainder;
+				deque_time[i] -= remainder;
+			}
+		}
+		last_seq_stop_times[gid] -= remainder;
+		last_seq_stop_times[gid] += 1;
+	}
+
+	void update_last_seq_stop_times(time_os_t curr_time) {
+		memset(last_seq_stop_times, 0, sizeof(last_seq_stop_times));
+		for(unsigned char qid=0; qid<n; qid++) {
+			time_os_t sst = st[qid] + dur[qid];
+			if(sst <= curr_time) continue;
+			if(os.is_sequential_station(sid[qid])) {
+				unsigned char gid = os.get_station_gid(sid[qid]);
+				if(sst > last_seq_stop_times[gid]) last_seq_stop_times[gid] = sst;
+			}
+		}
+	}
+
+	// with no station_qid assigned, turn_off_station leaves the queue alone
+	void toggle_pause(ulong delay, time_os_t curr_t) {
+		if(os.status.pause_state) {
+			time_os_t shift = (time_os_t)os.pause_timer - 1;
+			for(unsigned char qid=0; qid<n; qid++) {
+				st[qid] -= shift;
+				deque_time[qid] -= shift;
+			}
+			memset(last_seq_stop_times, 0, sizeof(last_seq_stop_times));
+			return;
+		}
+		for(unsigned char qid=0; qid<n; qid++) {
+			if(curr_t >= st[qid] + dur[qid]) {
+				continue;
+			} else if(curr_t >= st[qid]) {
+				dur[qid] -= (curr_t - st[qid]);
+				st[qid] = curr_t + delay;
+			} else {
+				st[qid] += delay;
+			}
+			deque_time[qid] += delay;
+			unsigned char gid = os.get_station_gid(sid[qid]);
+			if(gid >= NUM_SEQ_GROUPS) continue;
+			if(st[qid] + dur[qid] > last_seq_stop_times[gid]) last_seq_stop_times[gid] = st[qid] + dur[qid];
+		}
+	}
+};
+
+/** The queue and its lists against the reference */
+static bool queue_matches(const FlatQueue &ref) {
+	TEST_CHECK(pd.nqueue == ref.n);
+	for(unsigned char qid=0; qid<ref.n; qid++) {
+		TEST_CHECK(pd.queue.st[qid] == ref.st[qid]);
+		TEST_CHECK(pd.queue.deque_time[qid] == ref.deque_time[qid]);
+		TEST_CHECK(pd.queue.dur[qid] == ref.dur[qid]);
+		TEST_CHECK(pd.queue.sid[qid] == ref.sid[qid]);
+		TEST_CHECK(pd.queue.pid[qid] == ref.pid[qid]);
+	}
+	TEST_CHECK(memcmp(pd.last_seq_stop_times, ref.last_seq_stop_times, sizeof(ref.last_seq_stop_times)) == 0);
+
+	// every element is on exactly one list, in start time order unless pending
+	unsigned char seen[RUNTIME_QUEUE_SIZE];
+	memset(seen, 0, sizeof(seen));
+	for(unsigned char l=0; l<NUM_QUEUE_LISTS; l++) {
+		unsigned char p = QUEUE_NONE;
+		for(unsigned char qid=pd.queue.head[l]; qid!=QUEUE_NONE; p=qid, qid=pd.queue.next[qid]) {
+			TEST_CHECK(qid < pd.nqueue && !seen[qid]);
+			seen[qid] = 1;
+			TEST_CHECK(pd.queue.list[qid] == l && pd.queue.prev[qid] == p);
+			if(l == QUEUE_LIST_PENDING) {
+				TEST_CHECK(pd.queue.st[qid] == 0 || pd.queue.dur[qid] == 0);
+			} else {
+				TEST_CHECK(l == RuntimeQueue::group_list(pd.queue.sid[qid]));
+				TEST_CHECK(p == QUEUE_NONE || pd.queue.st[p] <= pd.queue.st[qid]);
+			}
+		}
+		TEST_CHECK(pd.queue.tail[l] == p);
+	}
+	for(unsigned char qid=0; qid<pd.nqueue; qid++) TEST_CHECK(seen[qid]);
+	return true;
+}
+
+/** A random duration, sometimes short enough to finish within one step */
+static uint16_t test_queue_dur() {
+	return (rand() % 4) ? 60 + rand() % 1800 : 1 + rand() % 60;
+}
+
+/** The clock is read by set_pause: keep clear of a second boundary */
+static time_os_t test_queue_clock() {
+	struct timespec ts;
+	for(;;) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		if(ts.tv_nsec < 900000000L) return os.now_tz();
+		usleep(1000);
+	}
+}
+
+/** Random enqueue/schedule/dequeue/overwrite/shift/pause sequences give the
+ * same queue as the flat queue, and the lists stay consistent.
+ */
+static bool test_queue_equivalence() {
+	static FlatQueue ref;
+	for(unsigned char m=0; m<NUM_MASTER_ZONES; m++) os.masters[m][MASOPT_SID] = 0;
+	os.iopts[IOPT_REMOTE_EXT_MODE] = 0;
+	for(int seq=0; seq<TEST_QUEUE_SEQUENCES; seq++) {
+		srand(seq);
+		for(unsigned char sid=0; sid<TEST_QUEUE_STATIONS; sid++) {
+			os.set_station_gid(sid, (rand() % 3) ? rand() % NUM_SEQ_GROUPS : PARALLEL_GROUP_ID);
+		}
+		// station delays from -60 to +60 seconds
+		os.iopts[IOPT_STATION_DELAY_TIME] = water_time_encode_signed(((rand() % 25) - 12) * 5);
+		pd.reset_runtime();
+		pd.clear_pause();
+		ref.reset();
+		time_os_t t = os.now_tz();
+		for(int op=0; op<TEST_QUEUE_OPS; op++) {
+			t += rand() % 120;
+			int kind = rand() % 8;
+			if(kind == 0 || pd.nqueue == 0) {
+				// a program start: a batch of new elements, scheduled together
+				int k = 1 + rand() % 8;
+				for(int i=0; i<k; i++) {
+					unsigned char sid = rand() % TEST_QUEUE_STATIONS;
+					uint16_t dur = test_queue_dur();
+					unsigned char qid = pd.enqueue(dur, sid, 1);
+					TEST_CHECK(qid == ref.enqueue(dur, sid, 1));
+				}
+				ref.schedule_all_stations(t);
+				schedule_all_stations(t);
+			} else if(kind == 1) {
+				// a manual run overwrites an element and schedules it again
+				unsigned char qid = rand() % pd.nqueue;
+				uint16_t dur = test_queue_dur();
+				pd.queue.set(qid, dur, pd.queue.sid[qid], 99);
+				ref.set(qid, dur, ref.sid[qid], 99);
+				ref.schedule_all_stations(t);
+				schedule_all_stations(t);
+			} else if(kind == 2) {
+				// the per-second pass removes finished elements
+				for(int qid=pd.nqueue-1; qid>=0; qid--) {
+					if(pd.queue.dur[qid] == 0 || t >= pd.queue.deque_time[qid]) {
+						pd.dequeue(qid);
+						ref.dequeue(qid);
+					}
+				}
+			} else if(kind == 3) {
+				// a sequential station is turned off early and its group moves up
+				unsigned char qid = rand() % pd.nqueue;
+				unsigned char sid = pd.queue.sid[qid];
+				if(!pd.queue.st[qid] || !os.is_sequential_station(sid)) continue;
+				unsigned char gid = os.get_station_gid(sid);
+				ref.handle_shift_remaining_stations(qid, gid, t);
+				ref.dequeue(qid);
+				handle_shift_remaining_stations(qid, gid, t);
+				pd.dequeue(qid);
+			} else if(kind == 4) {
+				ref.update_last_seq_stop_times(t);
+				update_last_seq_stop_times(t);
+			} else if(kind == 5) {
+				ulong delay = 1 + rand() % 600;
+				ref.toggle_pause(delay, test_queue_clock());
+				pd.toggle_pause(delay);
+			} else if(kind == 6) {
+				// station groups changed through /cs
+				os.set_station_gid(rand() % TEST_QUEUE_STATIONS, (rand() % 3) ? rand() % NUM_SEQ_GROUPS : PARALLEL_GROUP_ID);
+				pd.regroup_queue();
+			} else {
+				// reset_all_stations marks every element for removal
+				for(unsigned char qid=0; qid<ref.n; qid++) ref.dur[qid] = 0;
+				reset_all_stations();
+			}
+			if(!pd.nqueue) {
+				pd.reset_runtime();
+				pd.clear_pause();
+				ref.reset();
+			}
+			if(!queue_matches(ref)) {
+				printf("    sequence %d, operation %d (kind %d)\n", seq, op, kind);
+				return false;
+			}
+		}
+	}
+	pd.reset_runtime();
+	pd.clear_pause();
+	return true;
+}
+
+/** /jw spans outside of the rollup rows kept are refused, not answered with zeros */
+static bool test_rollup_retention() {
+	static RollupEntry totals[MAX_NUM_STATIONS];
+	time_os_t start, end;
+	time_os_t now = 1718452800L;  // 2024-06-15 12:00
+	OSRollup::clear();
+	OSRollup::add(3, now, 600, 1500);
+	TEST_CHECK(OSRollup::query(ROLLUP_SPAN_WEEK, now, now, totals, &start, &end));
+	TEST_CHECK(totals[3].seconds == 600 && totals[3].runs == 1 && totals[3].volume == 1500);
+	TEST_CHECK(OSRollup::query(ROLLUP_SPAN_MONTH, now, now, totals, &start, &end));
+	TEST_CHECK(totals[3].seconds == 600);
+	// oldest week whose first day is still kept, and the one before it
+	TEST_CHECK(OSRollup::query(ROLLUP_SPAN_WEEK, now-(ROLLUP_NUM_DAYS-7)*86400L, now, totals, &start, &end));
+	TEST_CHECK(!OSRollup::query(ROLLUP_SPAN_WEEK, now-(ROLLUP_NUM_DAYS-6)*86400L, now, totals, &start, &end));
+	TEST_CHECK(!OSRollup::query(ROLLUP_SPAN_WEEK, now+86400L, now, totals, &start, &end));
+	// last year is kept, the year before only partly, next month not yet
+	TEST_CHECK(OSRollup::query(ROLLUP_SPAN_YEAR, now-365*86400L, now, totals, &start, &end));
+	TEST_CHECK(!OSRollup::query(ROLLUP_SPAN_YEAR, now-2*365*86400L, now, totals, &start, &end));
+	TEST_CHECK(!OSRollup::query(ROLLUP_SPAN_MONTH, now+31*86400L, now, totals, &start, &end));
+	TEST_CHECK(OSRollup::query(ROLLUP_SPAN_MONTH, now-24*31*86400L+86400L*20, now, totals, &start, &end));
+	TEST_CHECK(totals[3].seconds == 0);
+	OSRollup::clear();
+	return true;
+}
+
+#define TEST_LOG_DAY  19723  // 2024-01-01
+// records are listed with their line endings, as /jl always has
+#define TEST_LOG_JSON "[1,2,300,1704067300]\r\n,[1,3,180,1704070200]\r\n,[1,4,240,1704071200]\r\n"
+
+/** Count the lines of a text log day, or -1 if it has none */
+static int test_text_lines(ulong day) {
+	snprintf(tmp_buffer, TMP_BUFFER_SIZE, "%lu", day);
+	make_logfile_name(tmp_buffer);
+	FILE *file = fopen(get_filename_fullpath(tmp_buffer), "rb");
+	if(!file) return -1;
+	char line[TMP_BUFFER_SIZE];
+	int n = 0;
+	while(fgets(line, sizeof(line), file)) n++;
+	fclose(file);
+	return n;
+}
+
+/** The writer keeps the text log next to the binary one; only -c removes it */
+static bool test_binlog_text_mirror() {
+	OSBinLog::remove_all();
+	mkdir(get_filename_fullpath(LOG_PREFIX), 0755);
+	snprintf(tmp_buffer, TMP_BUFFER_SIZE, "%d", TEST_LOG_DAY);
+	make_logfile_name(tmp_buffer);
+	// a record written by an earlier version
+	FILE *file = fopen(get_filename_fullpath(tmp_buffer), "wb");
+	TEST_CHECK(file != NULL);
+	fputs("[1,2,300,1704067300]\r\n", file);
+	fclose(file);
+	BinLogRecord rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.type = LOGDATA_STATION;
+	rec.pid = 1;
+	for(unsigned char sid=3; sid<5; sid++) {
+		rec.sid = sid;
+		rec.value = 60*sid;
+		rec.time = TEST_LOG_DAY*86400L + 1000*sid;
+		TEST_CHECK(OSBinLog::append(rec));
+	}
+	OSBinLog::sync();
+	TEST_CHECK(test_text_lines(TEST_LOG_DAY) == 3);
+	// each record is listed once, though it is in both logs
+	static char buf[1024];
+	BufferFiller out(buf, sizeof(buf));
+	json_log_days(out, TEST_LOG_DAY, TEST_LOG_DAY, "", false);
+	TEST_CHECK(strcmp(buf, TEST_LOG_JSON) == 0);
+	OSBinLog::close();
+	TEST_CHECK(OSBinLog::convert_all() == 1);
+	TEST_CHECK(test_text_lines(TEST_LOG_DAY) < 0);
+	out = BufferFiller(buf, sizeof(buf));
+	json_log_days(out, TEST_LOG_DAY, TEST_LOG_DAY, "", false);
+	TEST_CHECK(strcmp(buf, TEST_LOG_JSON) == 0);
+	OSBinLog::remove_all();
+	return true;
+}
+
+static const TestCase test_cases[] = {
+	{"session_token/sp", test_session_token_sp},
+#if defined(GPIOMEM) && defined(OSPI)
+	{"gpiomem/shift_out", test_gpiomem_shift_out},
+#endif
+	{"queue/equivalence", test_queue_equivalence},
+	{"rollup/retention", test_rollup_retention},
+	{"binlog/text_mirror", test_binlog_text_mirror},
+};
+
+/** Scratch controller with the default options */
+void OSTest::setup() {
+	if(!mkdtemp(data_dir)) {
+		perror("test: mkdtemp");
+		exit(1);
+	}
+	set_data_dir(data_dir);
+	os.begin();
+	os.options_setup();
+	pd.init();
+}
+
+static int test_rm(const char *path, const struct stat *, int, struct FTW *) {
+	return remove(path);
+}
+
+void OSTest::cleanup() {
+	nftw(data_dir, test_rm, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+int OSTest::run(const char *filter) {
+	setup();
+	int nrun = 0, nfailed = 0;
+	for(unsigned char i=0; i<sizeof(test_cases)/sizeof(test_cases[0]); i++) {
+		if(filter && !strstr(test_cases[i].name, filter)) continue;
+		printf("%s\n", test_cases[i].name);
+		nrun++;
+		if(!test_cases[i].fn()) {
+			printf("    FAILED\n");
+			nfailed++;
+		}
+		fflush(stdout);
+	}
+	printf("%d tests, %d failed\n", nrun, nfailed);
+	cleanup();
+	return nfailed;
+}
+
+#endif
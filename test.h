@@ -0,0 +1,64 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Unit tests header file
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEST_H
+#define _TEST_H
+
+#if defined(UNITTEST)
+
+#include "types.h"
+
+/** One test: fn returns false (after printing why) if it fails */
+struct TestCase {
+	const char *name;
+	bool (*fn)();
+};
+
+/** Firmware unit tests (build with -DDEMO -DUNITTEST, see make test)
+ * Each case runs against a scratch data directory with the demo (no-op)
+ * GPIO backend:
+ *
+ *   OpenSprinkler-test [filter]
+ *
+ * Only tests whose name contains filter are run. The exit status is the
+ * number of failed tests.
+ */
+class OSTest {
+public:
+	static int run(const char *filter);
+private:
+	static char data_dir[];
+	static void setup();
+	static void cleanup();
+};
+
+/** Fail the current test, naming the condition and where it is */
+#define TEST_CHECK(cond) do { \
+	if(!(cond)) { \
+		printf("    %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		return false; \
+	} \
+} while(0)
+
+#endif
+
+#endif // _TEST_H
@@ -39,6 +39,12 @@ extern OpenSprinkler os;
 
 #else // RPI/BBB
 
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(SIMULATION)
+#include <sys/mman.h>
+#endif
+
 static char* get_runtime_path() {
 	static char path[PATH_MAX];
 	static unsigned char query = 1;
@@ -74,6 +80,7 @@ const char* get_data_dir(void) {
 }
 
 void set_data_dir(const char *new_data_dir) {
+	file_close_all(); // cached handles refer to the old directory
 	data_dir = new_data_dir;
 }
 
@@ -87,6 +94,157 @@ char* get_filename_fullpath(const char *filename) {
 	return fullpath;
 }
 
+/** Data file handle cache
+ * Keeps one descriptor open per data file so that the block I/O
+ * functions below do not have to open/seek/close on every access.
+ * Writes go straight to the kernel via pwrite, so the cache holds
+ * no dirty data; file_flush_all only needs to fsync.
+ */
+#if defined(SIMULATION)
+/** In the simulation build the table is the file system: each data file
+ * lives in an anonymous memory file, seeded from the data directory on
+ * first use. The data directory is never written. A removed file keeps
+ * its slot with fd -1, so that it is not seeded again.
+ */
+#define FILE_CACHE_SIZE 64
+#else
+#define FILE_CACHE_SIZE 8
+#endif
+struct FileCacheEntry {
+	char name[32];	// data file name, empty if the slot is free
+	int fd;
+};
+static FileCacheEntry file_cache[FILE_CACHE_SIZE];
+static unsigned char file_cache_next = 0;	// next slot to evict when the table is full
+FileCacheStats file_cache_stats = {0, 0, 0, 0, 0};
+
+#if defined(SIMULATION)
+static int file_cache_find(const char *fn) {
+	for(unsigned char i=0;i<FILE_CACHE_SIZE;i++) {
+		if(file_cache[i].name[0] && strcmp(file_cache[i].name, fn)==0) return i;
+	}
+	return -1;
+}
+
+/** Slot of a file, taking a free one if it has none yet; -1 if the table is full */
+static int file_cache_slot(const char *fn) {
+	int i = file_cache_find(fn);
+	if(i>=0) return i;
+	if(strlen(fn)>=sizeof(file_cache[0].name)) return -1;
+	for(i=0;i<FILE_CACHE_SIZE;i++) {
+		if(!file_cache[i].name[0]) {
+			strcpy(file_cache[i].name, fn);
+			file_cache[i].fd = -1;
+			return i;
+		}
+	}
+	return -1;
+}
+
+/** Return the cached descriptor of a file, opening it if needed.
+ * If create is false, a missing file is not created and -1 is returned.
+ */
+static int file_cache_get(const char *fn, bool create) {
+	int i = file_cache_find(fn);
+	if(i>=0 && file_cache[i].fd>=0) {
+		file_cache_stats.hits++;
+		return file_cache[i].fd;
+	}
+	// seed from the data directory, unless the file has been removed in the meantime
+	int src = (i<0) ? open(get_filename_fullpath(fn), O_RDONLY) : -1;
+	if(src<0 && !create) return -1;
+	i = file_cache_slot(fn);
+	int fd = (i>=0) ? memfd_create(fn, MFD_CLOEXEC) : -1;
+	if(fd>=0 && src>=0) {
+		char buf[4096];
+		ssize_t n;
+		while((n = read(src, buf, sizeof(buf))) > 0) {
+			if(write(fd, buf, n) != n) break;
+		}
+	}
+	if(src>=0) close(src);
+	if(fd<0) return -1;
+	file_cache_stats.opens++;
+	file_cache[i].fd = fd;
+	return fd;
+}
+
+/** Drop the contents of a file and mark it as removed */
+static void file_cache_close(const char *fn) {
+	int i = file_cache_slot(fn);
+	if(i>=0 && file_cache[i].fd>=0) {
+		close(file_cache[i].fd);
+		file_cache_stats.closes++;
+		file_cache[i].fd = -1;
+	}
+}
+#else
+/** Return the cached descriptor of a file, opening it if needed.
+ * If create is false, a missing file is not created and -1 is returned.
+ */
+static int file_cache_get(const char *fn, bool create) {
+	unsigned char i;
+	for(i=0;i<FILE_CACHE_SIZE;i++) {
+		if(file_cache[i].name[0] && strcmp(file_cache[i].name, fn)==0) {
+			file_cache_stats.hits++;
+			return file_cache[i].fd;
+		}
+	}
+	if(strlen(fn)>=sizeof(file_cache[0].name)) return -1;
+	int fd = open(get_filename_fullpath(fn), create ? (O_RDWR|O_CREAT) : O_RDWR, 0644);
+	if(fd<0) return -1;
+	file_cache_stats.opens++;
+	// find an empty slot, otherwise evict round-robin
+	for(i=0;i<FILE_CACHE_SIZE;i++) {
+		if(!file_cache[i].name[0]) break;
+	}
+	if(i==FILE_CACHE_SIZE) {
+		i = file_cache_next;
+		file_cache_next = (file_cache_next+1)%FILE_CACHE_SIZE;
+		close(file_cache[i].fd);
+		file_cache_stats.closes++;
+	}
+	strcpy(file_cache[i].name, fn);
+	file_cache[i].fd = fd;
+	return fd;
+}
+
+/** Close the cached descriptor of a file (e.g. before it is removed) */
+static void file_cache_close(const char *fn) {
+	for(unsigned char i=0;i<FILE_CACHE_SIZE;i++) {
+		if(file_cache[i].name[0] && strcmp(file_cache[i].name, fn)==0) {
+			close(file_cache[i].fd);
+			file_cache_stats.closes++;
+			file_cache[i].name[0] = 0;
+		}
+	}
+}
+#endif
+
+/** Commit all cached data files to storage */
+void file_flush_all() {
+	for(unsigned char i=0;i<FILE_CACHE_SIZE;i++) {
+		if(file_cache[i].name[0] && file_cache[i].fd>=0) fsync(file_cache[i].fd);
+	}
+}
+
+/** Flush and close all cached data files */
+void file_close_all() {
+	file_flush_all();
+#if defined(SIMULATION)
+	// closing would lose the in-memory files
+	return;
+#endif
+	for(unsigned char i=0;i<FILE_CACHE_SIZE;i++) {
+		if(file_cache[i].name[0]) {
+			close(file_cache[i].fd);
+			file_cache_stats.closes++;
+			file_cache[i].name[0] = 0;
+		}
+	}
+	file_cache_next = 0;
+}
+
 void delay(ulong howLong)
 {
 	struct timespec sleeper, dummy ;
@@ -203,7 +361,10 @@ void remove_file(const char *fn) {
 
 #else
 
+	file_cache_close(fn);
+#if !defined(SIMULATION)
 	remove(get_filename_fullpath(fn));
+#endif
 
 #endif
 }
@@ -220,6 +381,10 @@ bool file_exists(const char *fn) {
 
 #else
 
+#if defined(SIMULATION)
+	int i = file_cache_find(fn);
+	if(i>=0) return file_cache[i].fd>=0;
+#endif
 	FILE *file;
 	file = fopen(get_filename_fullpath(fn), "rb");
 	if(file) {fclose(file); return true;}
@@ -252,11 +417,13 @@ void file_read_block(const char *fn, void *dst, ulong pos, ulong len) {
 
 #else
 
-	FILE *fp = fopen(get_filename_fullpath(fn), "rb");
-	if(fp) {
-		fseek(fp, pos, SEEK_SET);
-		fread(dst, 1, len, fp);
-		fclose(fp);
+	int fd = file_cache_get(fn, false);
+	if(fd>=0) {
+		ssize_t n = pread(fd, dst, len, pos);
+		file_cache_stats.reads++;
+		// zero out what lies beyond the end of file (e.g. options added by a newer firmware)
+		if(n<0) n = 0;
+		if((ulong)n<len) memset((char*)dst+n, 0, len-n);
 	}
 
 #endif
@@ -285,14 +452,10 @@ void file_write_block(const char *fn, const void *src, ulong pos, ulong len) {
 
 #else
 
-	FILE *fp = fopen(get_filename_fullpath(fn), "rb+");
-	if(!fp) {
-		fp = fopen(get_filename_fullpath(fn), "wb+");
-	}
-	if(fp) {
-		fseek(fp, pos, SEEK_SET); //this fails silently without the above change
-		fwrite(src, 1, len, fp);
-		fclose(fp);
+	int fd = file_cache_get(fn, true);
+	if(fd>=0) {
+		pwrite(fd, src, len, pos);
+		file_cache_stats.writes++;
 	}
 
 #endif
@@ -327,13 +490,14 @@ void file_copy_block(const char *fn, ulong from, ulong to, ulong len, void *tmp)
 
 #else
 
-	FILE *fp = fopen(get_filename_fullpath(fn), "rb+");
-	if(!fp) return;
-	fseek(fp, from, SEEK_SET);
-	fread(tmp, 1, len, fp);
-	fseek(fp, to, SEEK_SET);
-	fwrite(tmp, 1, len, fp);
-	fclose(fp);
+	int fd = file_cache_get(fn, false);
+	if(fd<0) return;
+	ssize_t n = pread(fd, tmp, len, from);
+	file_cache_stats.reads++;
+	if(n>0) {
+		pwrite(fd, tmp, n, to);
+		file_cache_stats.writes++;
+	}
 
 #endif
 
@@ -372,16 +536,21 @@ unsigned char file_cmp_block(const char *fn, const char *buf, ulong pos) {
 
 #else
 
-	FILE *fp = fopen(get_filename_fullpath(fn), "rb");
-	if(fp) {
-		fseek(fp, pos, SEEK_SET);
-		char c = fgetc(fp);
-		while(*buf && (c==*buf)) {
-			buf++;
-			c=fgetc(fp);
+	int fd = file_cache_get(fn, false);
+	if(fd>=0) {
+		// compare chunk by chunk, including the terminating 0
+		char chunk[64];
+		ulong len = strlen(buf)+1;
+		while(len) {
+			ulong n = (len<sizeof(chunk)) ? len : sizeof(chunk);
+			ssize_t r = pread(fd, chunk, n, pos);
+			file_cache_stats.reads++;
+			if(r!=(ssize_t)n || memcmp(chunk, buf, n)) return 1;
+			buf += n;
+			pos += n;
+			len -= n;
 		}
-		fclose(fp);
-		return (*buf==c)?0:1;
+		return 0;
 	}
 
 #endif
@@ -73,6 +73,17 @@ void str2mac(const char *_str, unsigned char mac[]);
 	const char* get_data_dir();
 	void set_data_dir(const char *new_data_dir);
 	char* get_filename_fullpath(const char *filename);
+	/** Data file handle cache counters */
+	struct FileCacheStats {
+		ulong opens;
+		ulong closes;
+		ulong hits;
+		ulong reads;
+		ulong writes;
+	};
+	extern FileCacheStats file_cache_stats;
+	void file_flush_all();
+	void file_close_all();
 	void delay(ulong ms);
 	void delayMicroseconds(ulong us);
 	void delayMicrosecondsHard(ulong us);
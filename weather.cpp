@@ -37,6 +37,8 @@ int wt_errCode = HTTP_RQT_NOT_RECEIVED;
 unsigned char wt_monthly[12] = {100,100,100,100,100,100,100,100,100,100,100,100};
 
 unsigned char findKeyVal (const char *str,char *strbuf, uint16_t maxlen,const char *key,bool key_in_pgm=false,uint8_t *keyfound=NULL);
+void kv_table_parse(const char *str);
+void kv_table_clear();
 
 // The weather function calls getweather.py on remote server to retrieve weather data
 // the default script is WEATHER_SCRIPT_HOST/weather?.py
@@ -50,6 +52,7 @@ static void getweather_callback(char* buffer) {
 		p++;
 	}
 	if (*p != '&')	return;
+	kv_table_parse(p);
 	int v;
 	bool save_nvdata = false;
 	// first check errCode, only update lswc timestamp if errCode is 0
@@ -121,11 +124,17 @@ static void getweather_callback(char* buffer) {
 	if (findKeyVal(p, wt_rawData, TMP_BUFFER_SIZE, PSTR("rawData"), true)) {
 		wt_rawData[TMP_BUFFER_SIZE-1]=0;  // make sure the buffer ends properly
 	}
+	kv_table_clear();
 
 	if(save_nvdata) os.nvdata_save();
 	write_log(LOGDATA_WATERLEVEL, os.checkwt_success_lasttime);
 }
 
+/** Record why a weather request failed; on success wt_errCode is set from the reply */
+static void getweather_done(int8_t result) {
+	if(result!=HTTP_RQT_SUCCESS) wt_errCode = result;
+}
+
 static void getweather_callback_with_peel_header(char* buffer) {
 	peel_http_header(buffer);
 	getweather_callback(buffer);
@@ -180,11 +189,8 @@ void GetWeather() {
 	strcat(ether_buffer, "\r\n\r\n");
 
 	wt_errCode = HTTP_RQT_NOT_RECEIVED;
-	int ret = os.send_http_request(host, ether_buffer, getweather_callback_with_peel_header);
-	if(ret!=HTTP_RQT_SUCCESS) {
-		if(wt_errCode < 0) wt_errCode = ret;
-		// if wt_errCode > 0, the call is successful but weather script may return error
-	}
+	int ret = os.send_http_request(host, ether_buffer, getweather_callback_with_peel_header, false, 5000, getweather_done);
+	if(ret!=HTTP_RQT_SUCCESS) getweather_done(ret);  // done is not called for a request that was not accepted
 }
 
 void load_wt_monthly(char* wto) {